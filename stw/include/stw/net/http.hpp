@@ -20,6 +20,7 @@
 #define STW_HTTP_HPP
 
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <unordered_map>
 #include <vector>
@@ -28,7 +29,67 @@
 
 namespace stw
 {
-	using http_headers = std::unordered_map<std::string, std::string>;
+	enum http_header_id
+	{
+		http_header_id_unknown,
+		http_header_id_accept,
+		http_header_id_accept_encoding,
+		http_header_id_authorization,
+		http_header_id_connection,
+		http_header_id_content_length,
+		http_header_id_content_type,
+		http_header_id_cookie,
+		http_header_id_expect,
+		http_header_id_host,
+		http_header_id_if_modified_since,
+		http_header_id_if_none_match,
+		http_header_id_keep_alive,
+		http_header_id_origin,
+		http_header_id_range,
+		http_header_id_set_cookie,
+		http_header_id_transfer_encoding,
+		http_header_id_upgrade,
+		http_header_id_user_agent,
+		http_header_id_count
+	};
+
+	struct http_header
+	{
+		std::string name;
+		std::string value;
+	};
+
+	// Headers in the order they were added. Names are compared case insensitive and may occur more than once.
+	// Clearing keeps the entries and their strings around, so filling it again for the next request doesn't allocate
+	// unless a value is longer than before. Well known headers are looked up in O(1).
+	class http_headers
+	{
+	public:
+		http_headers();
+		std::string &operator[](std::string_view name);
+		http_header &add(std::string_view name, std::string_view value);
+		void set(std::string_view name, std::string_view value);
+		bool contains(std::string_view name) const;
+		bool contains(http_header_id id) const;
+		const std::string *get(std::string_view name) const;
+		const std::string *get(http_header_id id) const;
+		size_t erase(std::string_view name);
+		void clear();
+		size_t size() const;
+		bool empty() const;
+		http_header *begin();
+		http_header *end();
+		const http_header *begin() const;
+		const http_header *end() const;
+		static http_header_id get_id(std::string_view name);
+	private:
+		std::vector<http_header> entries;
+		size_t count; // Entries past this are left over from before the last clear
+		int32_t known[http_header_id_count]; // Index of the first entry of each well known header, -1 if there is none
+		int32_t find(std::string_view name) const;
+		void update_known();
+	};
+
 	using http_cookies = std::unordered_map<std::string, std::string>;
 
 	struct http_cookie_options
@@ -137,8 +198,41 @@ namespace stw
 		std::string contentType;
 	};
 
-	// TODO: use other data structure for request and response headers
-	// Options are multimap or vector<header> etc.
+    enum http_scan_result
+    {
+        http_scan_result_incomplete,
+        http_scan_result_complete,
+        http_scan_result_error
+    };
+
+	// Finds the end of a request header. Scanning resumes where the previous call stopped, so a header that arrives
+	// in pieces is looked at only once, and a malformed request line is rejected before the rest of the header arrives.
+	// headerEnd is valid once scan returns http_scan_result_complete.
+	struct http_request_scanner
+	{
+		size_t headerEnd; // Position right after the empty line, where the body starts
+		http_request_scanner();
+		void reset();
+		http_scan_result scan(const char *data, size_t size);
+	private:
+		enum scan_state
+		{
+			scan_state_method,
+			scan_state_target,
+			scan_state_version,
+			scan_state_request_line_lf,
+			scan_state_line_start,
+			scan_state_header_line,
+			scan_state_header_line_lf,
+			scan_state_end_lf,
+			scan_state_done,
+			scan_state_error
+		};
+		scan_state state;
+		size_t offset;
+		size_t fieldStart; // Where the target or the version of the request line starts
+	};
+
 	struct http_request
 	{
 		http_method method;
@@ -151,7 +245,8 @@ namespace stw
 		http_request();
 		bool get_cookie(const std::string &name, std::string &value);
 		static bool parse(const std::string &requestBody, http_request &request);
-		static http_method get_http_method_from_string(const std::string &method);
+		static bool parse(const char *data, size_t size, http_request &request);
+		static http_method get_http_method_from_string(std::string_view method);
 		static std::string get_string_from_http_method(http_method method);
 	};
 
@@ -20,6 +20,7 @@
 #define STW_HTTP_CONFIG_HPP
 
 #include <string>
+#include <vector>
 #include <cstdint>
 
 namespace stw
@@ -28,10 +29,26 @@ namespace stw
 	{
         uint16_t port;
         uint32_t maxHeaderSize;
+        uint64_t maxBodySize; // In bytes, 0 disables the limit
         std::string bindAddress;
 		std::string publicHtmlPath;
 		std::string privateHtmlPath;
         std::string hostName;
+        bool reusePort;
+        bool edgeTriggered;
+        bool rebalanceConnections; // Busy workers hand idle keep-alive connections to the least loaded worker
+        uint32_t workerCount; // I/O worker threads, 0 uses one per CPU
+        uint32_t threadPoolSize; // Threads for blocking work, 0 uses one per CPU
+        std::vector<uint32_t> workerCpus; // Each worker is pinned to one of these in turn, empty leaves them unpinned
+        std::vector<uint32_t> threadPoolCpus; // Thread pool threads may run on any of these, empty leaves them unpinned
+        uint32_t processCount; // Above 1 the server forks this many worker processes that share the listener, POSIX only
+        std::string reloadSocketPath; // Unix socket a new server process uses to take over the listeners of this one, empty disables it
+        // Timeouts in seconds, 0 disables them
+        uint32_t firstByteTimeout; // From accepting a connection until the first byte of the request arrives
+        uint32_t headerTimeout; // From the first byte until the request header is complete
+        uint32_t bodyTimeout; // Longest wait for more body data while the handler reads it
+        uint32_t writeTimeout; // Longest wait for the client to accept more response data
+        uint32_t drainTimeout; // How long requests that are in progress may still take once the server stops
         void load_default();
 		bool load_from_file(const std::string &filePath);
     };
@@ -0,0 +1,56 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef STW_HTTP_PARSER_HPP
+#define STW_HTTP_PARSER_HPP
+
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>
+
+namespace stw
+{
+	struct http_header_view
+	{
+		std::string_view name;
+		std::string_view value;
+	};
+
+	// Slices of the parsed buffer, only valid as long as that buffer is
+	struct http_request_view
+	{
+		static constexpr size_t MAX_HEADERS = 100;
+		std::string_view method;
+		std::string_view target;
+		std::string_view version;
+		http_header_view headers[MAX_HEADERS];
+		size_t headerCount;
+	};
+
+	// Parses a request header without copying anything. Uses SSE4.2 when the CPU supports it, scalar code otherwise.
+	namespace http_parser
+	{
+		constexpr int64_t PARSE_ERROR = -1;
+		constexpr int64_t PARSE_INCOMPLETE = -2;
+
+		// Returns the size of the header including the empty line, or PARSE_ERROR or PARSE_INCOMPLETE
+		int64_t parse_request(const char *data, size_t size, http_request_view &request);
+		bool is_accelerated();
+	}
+}
+
+#endif
@@ -24,11 +24,19 @@
 #include "http.hpp"
 #include "http_config.hpp"
 #include "http_stream.hpp"
+#include "listener_handoff.hpp"
 #include "../system/thread_pool.hpp"
 #include "../system/queue.hpp"
 #include "../system/stream.hpp"
 #include "../system/date_time.hpp"
+#include "../system/timer_wheel.hpp"
+#include "../system/task.hpp"
 #include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <mutex>
 #include <cstdint>
 #include <cstdlib>
 #include <string>
@@ -37,61 +45,333 @@
 #include <thread>
 #include <functional>
 #include <unordered_map>
+#include <type_traits>
 
 namespace stw
 {
+    enum http_context_phase
+    {
+        http_context_phase_idle, // Waiting for the first byte of a request
+        http_context_phase_header,
+        http_context_phase_body, // The handler is running and may be reading the body
+        http_context_phase_receive, // The body is passed to a consumer as it arrives
+        http_context_phase_write
+    };
+
+    // Receives a request body piece by piece on the worker thread, as it arrives from the client. onData returns
+    // false to stop receiving. onComplete is called once, with complete set to false when the body could not be
+    // received in full, and returns the response. Neither is called when the connection is lost in between
+    struct http_body_consumer
+    {
+        std::function<bool(const void *data, size_t size)> onData;
+        std::function<http_response(bool complete)> onComplete;
+    };
+
+    struct http_read_awaitable;
+
     struct http_context
     {
-        std::shared_ptr<stw::socket> connection;
+        stw::socket connection;
         std::string requestBuffer;
 		std::string responseBuffer;
+        http_request_scanner scanner; // Keeps its position in requestBuffer between reads
         http_request request;
         http_response response;
+        http_stream stream;
+        http_body_consumer consumer; // Only set while a body is received for a consumer
+        http_read_awaitable *pendingRead; // Coroutine handler waiting for body data
+        stw::timer_node timer; // Deadline of the current phase
+        http_context_phase phase;
+        size_t requestOffset; // Bytes at the start of requestBuffer that belong to requests which were already dispatched
         uint64_t headerBytesSent;
 		uint32_t requestCount;
-		int64_t lastActivity;
+		uint32_t generation; // Token the socket is registered with, tells apart contexts that reuse a descriptor
 		bool closeConnection;
+		bool isChunked; // Content of unknown length is sent with chunked transfer encoding
+		bool isWriting; // Response is ready and being sent, only tracked in edge triggered mode
+		bool canRead; // Last read did not drain the socket, only tracked in edge triggered mode
 		std::atomic<bool> isLocked;
+		std::atomic<uint32_t> refCount; // The worker holds one while connected, thread pool tasks hold one while running
         http_context();
-		http_context(std::shared_ptr<stw::socket> s);
+		void end_request();
+		void reset();
+		void retain();
+		bool release();
+    };
+
+    struct http_completion_entry
+    {
+        http_context *context;
+        int32_t fd;
+        uint32_t generation;
+        http_response response;
+        bool isFailed; // The handle was dropped without a response
+    };
+
+    // Responses that were completed on other threads, waiting for the worker that owns their connection
+    struct http_completion_queue
+    {
+        std::mutex mutex;
+        std::vector<http_completion_entry> entries;
+        std::vector<std::coroutine_handle<>> resumptions; // Coroutines whose thread pool work is done
+        std::atomic<bool> hasEntries;
+        stw::poller *poller; // Of the owning worker, only used while the queue is open
+        bool isClosed;
+        http_completion_queue(stw::poller *poller);
+        void post(http_completion_entry &&entry);
+        void post(std::coroutine_handle<> handle);
+        void take(std::vector<http_completion_entry> &target, std::vector<std::coroutine_handle<>> &targetResumptions);
+        void close();
+    };
+
+    struct http_completion_state
+    {
+        std::shared_ptr<http_completion_queue> queue;
+        http_context *context;
+        int32_t fd;
+        uint32_t generation;
+        std::atomic<bool> isCompleted;
+        ~http_completion_state();
+    };
+
+    // Lets an asynchronous handler finish its request later, from any thread. Copies share the same request,
+    // the first call to complete wins. When the last copy goes away without a response the client gets a 500
+    class http_completion
+    {
+    public:
+        http_completion();
+        http_completion(const std::shared_ptr<http_completion_state> &state);
+        bool complete(http_response &&response);
+        bool is_completed() const;
+    private:
+        std::shared_ptr<http_completion_state> state;
+    };
+
+    // A connection waiting in the queue of a worker. Accepted ones have served no requests yet, connections that
+    // moved from another worker keep their count and the deadline of the keep-alive wait they were in
+    struct http_queued_connection
+    {
+        stw::socket_t handle;
+        uint32_t requestCount;
+        int64_t idleDeadline; // 0 when there is none
     };
 
     struct http_worker_context
     {
         http_worker_context();
-		bool enqueue(std::shared_ptr<stw::socket> s);
-        void remove(std::shared_ptr<http_context> context, const char *sender);
+		bool enqueue(stw::socket &s, uint32_t requestCount = 0, int64_t idleDeadline = 0);
+        void add(stw::socket &&s, uint32_t requestCount = 0, int64_t idleDeadline = 0);
+        uint32_t get_interest() const;
+        http_context *find(int32_t fd, uint32_t generation) const;
+        void remove(http_context *context, const char *sender);
+        void queue_pending(http_context *context);
+        void set_timeout(http_context *context, uint32_t milliseconds);
+        http_context *acquire();
+        void reclaim();
+        uint64_t get_load(int64_t now) const;
+        bool migrate(http_context *context, http_worker_context *target);
+        void rebalance();
+        void begin_drain();
+        bool is_stopping() const;
+        static http_worker_context *get_current();
         std::thread thread;
-		stw::queue<std::shared_ptr<stw::socket>,1024> queue;
-        std::unordered_map<int32_t,std::shared_ptr<http_context>> contexts;
+        stw::socket listener; // Only used when http_config::reusePort is set
+		stw::mpmc_queue<http_queued_connection> queue; // Fed by the accept loop and by other workers handing over idle connections
+        std::vector<http_worker_context*> siblings; // The other workers, only set when idle connections are rebalanced
+        std::vector<uint32_t> cpus; // The worker pins itself to these when it starts, empty leaves it unpinned
+        std::vector<http_context*> contexts; // Indexed by file descriptor
+        std::vector<std::unique_ptr<http_context[]>> contextSlabs; // Owns every context this worker allocated
+        std::vector<http_context*> freeContexts;
+        std::vector<http_context*> retiredContexts; // Removed while a thread pool task still held a reference
+        std::vector<stw::poll_event_result> pendingEvents; // Contexts that can continue without waiting for the poller
         std::unique_ptr<stw::poller> poller;
-		int64_t lastCleanup;
+        std::shared_ptr<http_completion_queue> completions; // Shared with the completion handles that are still around
+        stw::timer_wheel timers;
+        stw::timer_wheel sleepTimers; // Coroutines waiting in sleep_for, kept apart because their nodes don't belong to a context
+        stw::thread_pool *threadPool;
+		int64_t now; // Updated every time the worker wakes up
 		uint32_t maxRequests;
 		uint32_t keepAliveTime;
+		uint32_t firstByteTimeout;
+		uint32_t bodyTimeout;
+		uint32_t nextGeneration;
+		int64_t lastRebalance;
+		bool edgeTriggered;
+		std::atomic<bool> isDraining; // Also read by thread pool threads that prepare a response
         std::atomic<bool> stopFlag;
+        std::atomic<int64_t> drainDeadline; // Set when the server stops, the worker finishes the requests it has until then
+        // Read by other threads to decide where new connections go
+        std::atomic<uint64_t> servedRequests;
+        std::atomic<uint32_t> connectionCount;
+        std::atomic<uint32_t> queuedCount; // Sockets in the queue that weren't added yet
+        std::atomic<int64_t> busySince; // When the worker woke up to process events, 0 while it waits for the poller
+    };
+
+    // Awaitables for coroutine handlers. They can only be awaited on a worker thread and always resume there
+
+    struct http_sleep_awaitable
+    {
+        uint32_t milliseconds;
+        stw::timer_node timer;
+        bool await_ready() const noexcept { return milliseconds == 0; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const noexcept {}
+    };
+
+    // Reads like http_stream::read but waits for data instead of failing with EAGAIN. A result of -1 means the
+    // body could not be read, because it was malformed, the body timeout expired or the connection was lost
+    struct http_read_awaitable
+    {
+        http_stream *stream;
+        void *buffer;
+        size_t size;
+        int64_t result;
+        bool isAborted;
+        std::coroutine_handle<> handle;
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> handle);
+        int64_t await_resume();
+    };
+
+    // Runs a function on the thread pool, the awaiting coroutine continues on its worker with the result
+    template<typename F>
+    struct http_offload_awaitable
+    {
+        using result_type = std::invoke_result_t<F>;
+        using storage_type = std::conditional_t<std::is_void_v<result_type>, bool, std::optional<result_type>>;
+        F function;
+        storage_type result {};
+        std::exception_ptr exception;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            http_worker_context *worker = http_worker_context::get_current();
+
+            if (!worker)
+                throw std::runtime_error("Coroutines can only be suspended on a worker thread");
+
+            std::shared_ptr<http_completion_queue> queue = worker->completions;
+
+            // Nothing of this awaitable is touched once the handle is posted, the worker may have resumed already
+            bool isQueued = worker->threadPool->enqueue([this, handle, queue]() {
+                try
+                {
+                    if constexpr (std::is_void_v<result_type>)
+                        function();
+                    else
+                        result.emplace(function());
+                }
+                catch (...)
+                {
+                    exception = std::current_exception();
+                }
+
+                queue->post(handle);
+            });
+
+            if (!isQueued)
+                throw std::runtime_error("The thread pool is saturated");
+        }
+
+        result_type await_resume()
+        {
+            if (exception)
+                std::rethrow_exception(exception);
+
+            if constexpr (!std::is_void_v<result_type>)
+                return std::move(*result);
+        }
+    };
+
+    http_sleep_awaitable sleep_for(uint32_t milliseconds);
+    http_read_awaitable read_async(http_stream *stream, void *buffer, size_t size);
+
+    // Blocking work such as outgoing http_client requests belongs here, a worker must never wait on it
+    template<typename F>
+    http_offload_awaitable<std::decay_t<F>> offload(F &&function)
+    {
+        return http_offload_awaitable<std::decay_t<F>> { std::forward<F>(function) };
+    }
+
+    // Counters of one server process. In prefork mode they live in memory that all processes share, each child
+    // publishes its own slot and the parent reads them all
+    struct alignas(64) http_process_stats
+    {
+        std::atomic<uint64_t> connectionCount;
+        std::atomic<uint64_t> requestCount;
+        std::atomic<uint32_t> restartCount;
+        std::atomic<int32_t> processId; // 0 while no process runs in this slot
+    };
+
+    struct http_server_stats
+    {
+        uint64_t connectionCount;
+        uint64_t requestCount; // Since the server started, a process that died loses what it served since its last update
+        uint32_t processCount; // Processes that are running
+        uint32_t restartCount;
     };
 
     using request_handler = std::function<http_response(http_request &request, http_stream *stream)>;
+	using task_request_handler = std::function<stw::task<http_response>(http_request &request, http_stream *stream)>;
+	using async_request_handler = std::function<void(http_request &request, http_stream *stream, http_completion completion)>;
+	using request_body_handler = std::function<bool(http_request &request, http_body_consumer &consumer)>;
 	using close_handler = std::function<void()>;
 
     class http_server
     {
     public:
         request_handler onRequest;
+		async_request_handler onRequestAsync; // Used instead of onRequest when set, the body has to be read before it returns
+		task_request_handler onRequestTask; // Takes precedence over both other handlers, runs as a coroutine on the worker
+		request_body_handler onRequestBody; // Called first for requests with a body, returning true hands the body to the consumer instead of onRequest
 		close_handler onClose;
         http_server();
+        ~http_server();
         int run(const stw::http_config &config);
+        http_server_stats get_stats() const;
     private:
         stw::socket listener;
+        std::unique_ptr<stw::poller> poller;
 		stw::http_config config;
         std::atomic<bool> isRunning;
         std::unique_ptr<stw::thread_pool> threadPool;
+        stw::listener_handoff handoff;
+        std::vector<socket_handle> inheritedListeners; // Taken over from the server this one replaces, until they are used
+        http_process_stats *processStats; // One slot per process, mapped shared in prefork mode
+        size_t processStatsCount;
+        bool isStatsShared;
+        int32_t processIndex; // Slot of this process in processStats
+        uint64_t requestBase; // Requests that were counted in this slot before this process started
+        bool isChildProcess;
+        int open_listener();
+        bool take_inherited_listener(stw::socket &target);
+        void open_handoff();
+        bool hand_off(const std::vector<std::unique_ptr<http_worker_context>> &workers);
+        int run_workers();
+        int run_supervisor();
+        void publish_stats(const std::vector<std::unique_ptr<http_worker_context>> &workers);
+        bool allocate_stats(size_t count, bool shared);
+        void free_stats();
         void worker_update(http_worker_context *worker);
-        void on_read(http_worker_context *worker, int32_t fd);
-        void on_write(http_worker_context *worker, int32_t fd);
-		void process_request(http_worker_context *worker, std::shared_ptr<http_context> context, std::shared_ptr<http_stream> networkStream);
-        void finalize_request(http_worker_context *worker, std::shared_ptr<http_context> context);
-		void send_response(http_worker_context *worker, std::shared_ptr<http_context> context, uint32_t statusCode);
+        void on_accept(http_worker_context *worker);
+        void on_event(http_worker_context *worker, const stw::poll_event_result &ev);
+        void on_read(http_worker_context *worker, http_context *context);
+        bool on_request(http_worker_context *worker, http_context *context);
+        void on_body(http_worker_context *worker, http_context *context);
+        void on_body_ready(http_worker_context *worker, http_context *context, bool isAborted);
+        void on_body_complete(http_worker_context *worker, http_context *context, bool complete);
+        void on_write(http_worker_context *worker, http_context *context);
+        void on_timeout(http_worker_context *worker, http_context *context);
+        void on_ready(http_worker_context *worker, http_context *context);
+		bool process_request(http_worker_context *worker, http_context *context);
+		void on_complete(http_worker_context *worker, http_completion_entry &entry);
+		void prepare_response(http_worker_context *worker, http_context *context);
+        void finalize_request(http_worker_context *worker, http_context *context);
+		bool batch_response(http_worker_context *worker, http_context *context);
+		void send_response(http_worker_context *worker, http_context *context, uint32_t statusCode);
+		void set_error_response(http_context *context, uint32_t statusCode);
     };
 }
 
@@ -23,23 +23,57 @@
 #include <string>
 #include <cstdint>
 #include <cstdlib>
-#include <memory>
 
 namespace stw
 {
+	enum http_chunk_state
+	{
+		http_chunk_state_size,
+		http_chunk_state_extension,
+		http_chunk_state_size_lf,
+		http_chunk_state_data,
+		http_chunk_state_data_cr,
+		http_chunk_state_data_lf,
+		http_chunk_state_trailer,
+		http_chunk_state_trailer_line,
+		http_chunk_state_trailer_lf,
+		http_chunk_state_done,
+		http_chunk_state_error
+	};
+
 	class http_stream
 	{
 	public:
+		static constexpr uint64_t UNKNOWN_LENGTH = UINT64_MAX;
 		http_stream();
-		http_stream(std::shared_ptr<stw::socket> socket, void *initialContent, uint64_t initialContentLength);
-		~http_stream();
+		http_stream(stw::socket *socket, const void *initialContent, uint64_t initialContentLength, uint64_t contentLength = UNKNOWN_LENGTH);
+		void reset(stw::socket *socket, const void *initialContent, uint64_t initialContentLength, uint64_t contentLength = UNKNOWN_LENGTH);
+		void set_chunked(uint64_t maxBodySize);
 		int64_t read(void *buffer, size_t size);
 		bool read_as_string(std::string &str, uint64_t size);
+		uint64_t get_unread_socket_bytes() const;
+		bool is_complete() const;
+		bool is_invalid() const;
+		bool is_too_large() const;
+		stw::socket *get_socket() const;
+		uint64_t get_surplus_bytes() const;
+		const std::string &get_socket_surplus() const;
 	private:
-		std::shared_ptr<stw::socket> socket;
-		void *initialContent;
+		stw::socket *socket;
+		const void *initialContent; // Not owned, must stay valid while the stream is read
 		uint64_t initialContentLength;
 		uint64_t initialContentConsumed;
+		uint64_t socketBytesRemaining; // Part of the body that hasn't been read from the socket yet, reads stop there
+		http_chunk_state chunkState;
+		uint64_t chunkRemaining; // Size of the current chunk while its size line is read, afterwards what is left of its data
+		bool hasChunkSize; // The size line being read has at least one digit
+		uint64_t maxBodySize; // 0 means no limit
+		uint64_t bodyBytesRead;
+		bool isChunked;
+		bool isTooLarge;
+		std::string socketSurplus; // What the last socket read got past the end of the chunked body
+		int64_t read_raw(void *buffer, size_t size);
+		int64_t decode_chunked(uint8_t *buffer, size_t size, size_t &consumed);
 	};
 }
 
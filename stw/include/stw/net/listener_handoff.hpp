@@ -0,0 +1,49 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef STW_LISTENER_HANDOFF_HPP
+#define STW_LISTENER_HANDOFF_HPP
+
+#include "socket.hpp"
+#include <string>
+#include <vector>
+
+namespace stw
+{
+	// Passes the listening sockets of a running server to the process that replaces it, over a Unix domain socket.
+	// The new process asks for them with receive before it binds anything, so the listeners never close and no
+	// connection is refused in between. Only supported on POSIX systems, everything fails elsewhere
+	class listener_handoff
+	{
+	public:
+		listener_handoff();
+		listener_handoff(const listener_handoff &other) = delete;
+		listener_handoff &operator=(const listener_handoff &other) = delete;
+		~listener_handoff();
+		bool listen(const std::string &path);
+		bool send(const std::vector<socket_handle> &descriptors);
+		void close(bool removePath);
+		socket_handle get_file_descriptor() const;
+		static bool receive(const std::string &path, std::vector<socket_handle> &descriptors);
+	private:
+		socket_handle fd;
+		std::string path;
+	};
+}
+
+#endif
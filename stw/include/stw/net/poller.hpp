@@ -30,24 +30,29 @@ namespace stw
 		poll_event_read = 0x01,
 		poll_event_write = 0x02,
 		poll_event_error = 0x04,
-		poll_event_disconnect = 0x08 // Maybe useful for things other than non fatal error?
+		poll_event_disconnect = 0x08, // Maybe useful for things other than non fatal error?
+		poll_event_edge_triggered = 0x10 // Only valid for add/modify, see poller::supports_edge_triggered
 	};
 
 	struct poll_event_result 
 	{
 		int32_t fd;
 		uint32_t flags;
+		uint32_t token; // Value that was passed to add/modify for this descriptor
 	};
 
 	class poller
 	{
 	public:
 		virtual ~poller() {}
-		virtual bool add(int32_t fd, poll_event_flag flags) = 0;
+		// Flags are a combination of poll_event_flag values. The token is opaque to the poller and is
+		// handed back with every event, so callers can validate it against descriptors that got reused
+		virtual bool add(int32_t fd, uint32_t flags, uint32_t token = 0) = 0;
 		virtual bool remove(int32_t fd) = 0;
-		virtual bool modify(int32_t fd, poll_event_flag flags) = 0;
+		virtual bool modify(int32_t fd, uint32_t flags, uint32_t token = 0) = 0;
 		virtual void notify() = 0;
 		virtual int32_t wait(std::vector<poll_event_result> &results, int32_t timeout) = 0;
+		virtual bool supports_edge_triggered() const { return false; }
 		static std::unique_ptr<poller> create();
 	};
 }
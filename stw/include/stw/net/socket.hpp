@@ -50,6 +50,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace stw
 {
@@ -98,6 +99,12 @@ namespace stw
         address_family addressFamily;
     } socket_t;
 
+	struct socket_buffer
+	{
+		const void *data;
+		size_t size;
+	};
+
 	enum socket_protocol_type
 	{
 		socket_protocol_type_tcp,
@@ -110,19 +117,25 @@ namespace stw
 		socket();
 		socket(socket_protocol_type protocolType);
 		socket(socket_protocol_type protocolType, const std::string &ip, uint16_t port);
+		socket(const socket_t &handle, socket_protocol_type protocolType = socket_protocol_type_tcp);
 		socket(const socket &other) = delete;
 		socket(socket &&other) noexcept;
 		socket &operator=(const socket &other) = delete;
 		socket &operator=(socket &&other) noexcept;
 		~socket();
 		bool connect(const std::string &ip, uint16_t port);
-		bool bind(const std::string &bindAddress, uint16_t port);
+		bool bind(const std::string &bindAddress, uint16_t port, bool reusePort = false);
 		bool listen(int32_t backlog);
 		bool accept(socket *target);
+		size_t accept_batch(std::vector<socket> &targets, size_t maxCount);
 		void close();
+		socket_t release();
+		bool adopt(socket_handle fd);
 		int64_t read(void *buffer, size_t size);
 		int64_t peek(void *buffer, size_t size);
 		int64_t write(const void *buffer, size_t size);
+		int64_t write(const socket_buffer *buffers, size_t count, bool more = false);
+		int64_t send_file(int32_t fileDescriptor, int64_t &offset, size_t size);
 		bool read_all(void *buffer, size_t size);
 		bool write_all(const void *buffer, size_t size);
 		bool set_option(int32_t level, int32_t option, const void *value, uint32_t valueSize);
@@ -135,6 +148,7 @@ namespace stw
 	private:
 		socket_t s;
 		socket_protocol_type protocolType;
+		bool set_reuse_port();
 	};
 }
 
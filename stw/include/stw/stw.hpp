@@ -10,6 +10,7 @@
 #include "net/http_session_manager.hpp"
 #include "net/http_stream.hpp"
 #include "net/http_config.hpp"
+#include "net/listener_handoff.hpp"
 #include "net/poller.hpp"
 #include "net/ssl.hpp"
 #include "net/socket.hpp"
@@ -24,6 +25,9 @@
 #include "system/file.hpp"
 #include "system/date_time.hpp"
 #include "system/thread_pool.hpp"
+#include "system/unique_function.hpp"
+#include "system/task.hpp"
+#include "system/timer_wheel.hpp"
 #include "system/stream.hpp"
 #include "system/signal.hpp"
 #include "system/directory.hpp"
@@ -20,27 +20,42 @@
 #define STW_QUEUE_HPP
 
 #include <atomic>
-#include <vector>
-#include <optional>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
 
 namespace stw
 {
+	// Indices that are written by different threads are kept on separate cache lines
+	static constexpr size_t QUEUE_CACHE_LINE_SIZE = 64;
+
 	//Single producer, single consumer queue
 	template <typename T, size_t Size>
 	class queue
 	{
 	public:
-		bool enqueue(T value)
+		bool enqueue(const T &value)
+		{
+			T copy = value;
+			return enqueue(std::move(copy));
+		}
+
+		bool enqueue(T &&value)
 		{
 			size_t t = tail.load(std::memory_order_relaxed);
 			size_t next_t = (t + 1) & mask;
 
-			if (next_t == head.load(std::memory_order_acquire))
+			// The head is only loaded again when the queue looks full, most calls never touch the consumer's cache line
+			if (next_t == cachedHead)
 			{
-				return false; // Queue is full
+				cachedHead = head.load(std::memory_order_acquire);
+
+				if (next_t == cachedHead)
+					return false; // Queue is full
 			}
 
-			buffer[t] = value;
+			buffer[t] = std::move(value);
 			// Release ensures the data write above is visible before tail is updated
 			tail.store(next_t, std::memory_order_release);
 			return true;
@@ -52,24 +67,159 @@ namespace stw
 			size_t h = head.load(std::memory_order_relaxed);
 
 			// Acquire ensures we see the data written before the producer updated tail
-			if (h == tail.load(std::memory_order_acquire))
+			if (h == cachedTail)
 			{
-				return false; // Queue is empty
+				cachedTail = tail.load(std::memory_order_acquire);
+
+				if (h == cachedTail)
+					return false; // Queue is empty
 			}
 
-			outValue = buffer[h];
+			outValue = std::move(buffer[h]);
 			head.store((h + 1) & mask, std::memory_order_release);
 			return true;
 		}
+
+		// Takes up to maxCount values and frees their slots with a single store. Returns the number of values taken
+		size_t try_dequeue_bulk(T *outValues, size_t maxCount)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			size_t available = (cachedTail - h) & mask;
+
+			// Unlike a single dequeue this looks at tail again whenever the last snapshot can't fill the request
+			if (available < maxCount)
+			{
+				cachedTail = tail.load(std::memory_order_acquire);
+				available = (cachedTail - h) & mask;
+			}
+
+			size_t count = available < maxCount ? available : maxCount;
+
+			for (size_t i = 0; i < count; i++)
+				outValues[i] = std::move(buffer[(h + i) & mask]);
+
+			if (count > 0)
+				head.store((h + count) & mask, std::memory_order_release);
+
+			return count;
+		}
 	private:
 		// Size must be a power of 2 for the mask trick to work
 		static_assert((Size & (Size - 1)) == 0, "Size must be a power of 2");
 
-		T buffer[Size];
-		std::atomic<size_t> head{0};
-		std::atomic<size_t> tail{0};
+		// Written by the consumer, cachedTail is its last look at tail
+		alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> head{0};
+		size_t cachedTail = 0;
+		// Written by the producer, cachedHead is its last look at head
+		alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> tail{0};
+		size_t cachedHead = 0;
+		alignas(QUEUE_CACHE_LINE_SIZE) T buffer[Size];
 		static constexpr size_t mask = Size - 1;
 	};
+
+	// Bounded multi producer, multi consumer queue (Vyukov). Every slot carries a sequence number that tells
+	// producers and consumers whose turn it is, so neither side takes a lock. The capacity is rounded up to a
+	// power of two and fixed, enqueue fails when the queue is full
+	template <typename T>
+	class mpmc_queue
+	{
+	public:
+		mpmc_queue(size_t capacity)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+
+			mask = size - 1;
+			cells = std::make_unique<cell[]>(size);
+
+			for (size_t i = 0; i < size; i++)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		mpmc_queue(const mpmc_queue &other) = delete;
+		mpmc_queue &operator=(const mpmc_queue &other) = delete;
+
+		bool enqueue(T &&value)
+		{
+			cell *target;
+			size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				target = &cells[position & mask];
+				size_t sequence = target->sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+				if (difference == 0)
+				{
+					// The slot is free, claim it before another producer does
+					if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (difference < 0)
+				{
+					return false; // Queue is full, the slot still holds a value from the previous lap
+				}
+				else
+				{
+					position = enqueuePosition.load(std::memory_order_relaxed);
+				}
+			}
+
+			target->data = std::move(value);
+			target->sequence.store(position + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool try_dequeue(T &outValue)
+		{
+			cell *source;
+			size_t position = dequeuePosition.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				source = &cells[position & mask];
+				size_t sequence = source->sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+				if (difference == 0)
+				{
+					if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (difference < 0)
+				{
+					return false; // Queue is empty
+				}
+				else
+				{
+					position = dequeuePosition.load(std::memory_order_relaxed);
+				}
+			}
+
+			outValue = std::move(source->data);
+			// Hands the slot to the producer of the next lap
+			source->sequence.store(position + mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		size_t get_capacity() const
+		{
+			return mask + 1;
+		}
+	private:
+		struct cell
+		{
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> enqueuePosition{0};
+		alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> dequeuePosition{0};
+		alignas(QUEUE_CACHE_LINE_SIZE) std::unique_ptr<cell[]> cells;
+		size_t mask;
+	};
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 namespace stw::runtime
 {
@@ -31,6 +32,7 @@ namespace stw::runtime
 	void set_current_working_directory(const std::string &directoryPath);
 	std::string get_current_working_directory();
 	bool run_command(const std::string &cmd, const std::vector<std::string> &args, std::string &output);
+	bool set_thread_affinity(const std::vector<uint32_t> &cpus);
 }
 
 #endif
\ No newline at end of file
@@ -23,6 +23,7 @@
 #include <cstdint>
 #include <string>
 #include <fstream>
+#include <functional>
 
 namespace stw
 {
@@ -48,6 +49,8 @@ namespace stw
 		virtual int64_t write(const void *buffer, size_t size) = 0;
 		virtual int64_t seek(int64_t offset, seek_origin origin) = 0;
 		virtual int64_t get_read_offset() = 0;
+		virtual int32_t get_file_descriptor() { return -1; } // Only streams backed by a file have one
+		virtual const void *get_memory() const { return nullptr; } // Only streams backed by memory have one
 		int64_t get_length() const { return length; }
 	protected:
 		int64_t readPosition = 0;
@@ -64,9 +67,27 @@ namespace stw
 		int64_t write(const void *buffer, size_t size) override;
 		int64_t seek(int64_t offset, seek_origin origin) override;
 		int64_t get_read_offset() override;
+		int32_t get_file_descriptor() override;
 	private:
 		file_access access;
 		std::fstream file;
+		int32_t fd; // Replaces the fstream for read only files on Unix, so reads and sendfile share one open file
+	};
+
+	// Content of unknown length that is generated while it is sent. The producer fills the buffer and returns
+	// the number of bytes written, 0 when there is nothing left or -1 on failure. It is called from the worker
+	// thread each time the socket can take more data, so it should not block for long
+	class producer_stream : public stream
+	{
+	public:
+		using producer = std::function<int64_t(void *buffer, size_t size)>;
+		producer_stream(const producer &callback);
+		int64_t read(void *buffer, size_t size) override;
+		int64_t write(const void *buffer, size_t size) override;
+		int64_t seek(int64_t offset, seek_origin origin) override;
+		int64_t get_read_offset() override;
+	private:
+		producer callback;
 	};
 
 	class memory_stream : public stream
@@ -78,6 +99,7 @@ namespace stw
 		int64_t write(const void *buffer, size_t size) override;
 		int64_t seek(int64_t offset, seek_origin origin) override;
 		int64_t get_read_offset() override;
+		const void *get_memory() const override { return memory; }
 	private:
 		void *memory;
 		size_t size;
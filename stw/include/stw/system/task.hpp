@@ -0,0 +1,148 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef STW_TASK_HPP
+#define STW_TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace stw
+{
+	template<typename T>
+	class task;
+
+	// Resumes whoever awaited the task once it has finished
+	struct task_final_awaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template<typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	struct task_promise_base
+	{
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		task_final_awaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+
+	template<typename T>
+	struct task_promise : task_promise_base
+	{
+		std::optional<T> value;
+
+		task<T> get_return_object();
+
+		template<typename U>
+		void return_value(U &&result)
+		{
+			value.emplace(std::forward<U>(result));
+		}
+	};
+
+	template<>
+	struct task_promise<void> : task_promise_base
+	{
+		task<void> get_return_object();
+		void return_void() const noexcept {}
+	};
+
+	// Lazily started coroutine. It runs once it is awaited and hands its result, or exception, to the awaiting coroutine.
+	// Where it continues after a suspension depends on what it awaited, the awaitables in http_server resume on the worker
+	template<typename T = void>
+	class task
+	{
+	public:
+		using promise_type = task_promise<T>;
+
+		task() : handle(nullptr) {}
+
+		explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+		task(const task &other) = delete;
+
+		task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+		task &operator=(const task &other) = delete;
+
+		task &operator=(task &&other) noexcept
+		{
+			if(this != &other)
+			{
+				if(handle)
+					handle.destroy();
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+
+		~task()
+		{
+			if(handle)
+				handle.destroy();
+		}
+
+		bool await_ready() const noexcept
+		{
+			return !handle || handle.done();
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			handle.promise().continuation = awaiting;
+			return handle;
+		}
+
+		T await_resume()
+		{
+			if(handle.promise().exception)
+				std::rethrow_exception(handle.promise().exception);
+
+			if constexpr (!std::is_void_v<T>)
+				return std::move(*handle.promise().value);
+		}
+	private:
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	template<typename T>
+	task<T> task_promise<T>::get_return_object()
+	{
+		return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+	}
+
+	inline task<void> task_promise<void>::get_return_object()
+	{
+		return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+	}
+}
+
+#endif
@@ -19,33 +19,76 @@
 #ifndef STW_THREAD_POOL_HPP
 #define STW_THREAD_POOL_HPP
 
-#include <iostream>
+#include "unique_function.hpp"
+#include "queue.hpp"
 #include <thread>
 #include <vector>
-#include <queue>
+#include <memory>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
-#include <functional>
+#include <cstdint>
 #include <cstdlib>
 
 namespace stw
 {
+	// Chase-Lev deque. Only the owning thread pushes and pops at the bottom, other threads steal from the top.
+	// Tasks are moved into slots the deque owns, so queueing one doesn't allocate. The capacity is fixed, push
+	// fails when it is full and leaves the task with the caller
+	class work_stealing_deque
+	{
+	public:
+		work_stealing_deque(size_t capacity);
+		work_stealing_deque(const work_stealing_deque &other) = delete;
+		work_stealing_deque &operator=(const work_stealing_deque &other) = delete;
+		bool push(unique_function &&task);
+		bool pop(unique_function &task);
+		bool steal(unique_function &task);
+		bool can_push() const; // Only meaningful on the owning thread, a push that follows it can't fail
+	private:
+		// A slot stays occupied until whoever claimed its task has moved it out, push does not reuse it before that
+		struct slot
+		{
+			std::atomic<bool> isOccupied{false};
+			unique_function task;
+		};
+		alignas(64) std::atomic<int64_t> top;
+		alignas(64) std::atomic<int64_t> bottom;
+		std::unique_ptr<slot[]> slots;
+		int64_t capacity;
+		int64_t mask;
+	};
+
+	// Tasks enqueued by other threads go through a bounded injection queue, enqueue returns false when it is full so
+	// callers can reject work instead of piling it up. A thread that takes from it moves a few more tasks to its own
+	// deque, tasks enqueued from inside a task go there as well. Idle threads steal from the others before they sleep
 	class thread_pool
 	{
 	public:
-		thread_pool();
+		thread_pool(size_t threadCount = 0, size_t queueCapacity = 4096, const std::vector<uint32_t> &cpus = {});
+		thread_pool(const thread_pool &other) = delete;
+		thread_pool &operator=(const thread_pool &other) = delete;
     	~thread_pool();
-		void enqueue(std::function<void()> task);
+		bool enqueue(unique_function &&task);
 		bool is_available() const;
+		size_t get_thread_count() const;
 	private:
-		std::vector<std::thread> workers;
-		std::queue<std::function<void()>> taskQueue;
-		std::mutex queueMutex;
+		struct worker
+		{
+			std::thread thread;
+			std::unique_ptr<work_stealing_deque> tasks;
+		};
+		std::vector<worker> workers;
+		std::vector<uint32_t> cpus; // Threads pin themselves to these when they start
+		mpmc_queue<unique_function> injectionQueue;
+		std::mutex queueMutex; // Only used to put threads to sleep and wake them
 		std::condition_variable cv;
+		std::atomic<size_t> pendingTasks; // Tasks in any queue, idle threads only sleep when it is 0
+		std::atomic<size_t> sleepingThreads;
 		std::atomic<bool> stopFlag;
-		std::atomic<size_t> activeThreads;
-		void worker_thread();
+		void worker_thread(size_t index);
+		bool take_task(size_t index, unique_function &task);
+		void wake_one();
 	};
 }
 
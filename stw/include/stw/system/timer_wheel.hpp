@@ -0,0 +1,69 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef STW_TIMER_WHEEL_HPP
+#define STW_TIMER_WHEEL_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+namespace stw
+{
+	// Intrusive, embed it in the object that needs a timeout
+	struct timer_node
+	{
+		timer_node *next;
+		timer_node *prev;
+		int64_t expiry;
+		void *userData;
+		size_t slot;
+		bool scheduled;
+		timer_node();
+		bool is_scheduled() const;
+	};
+
+	// Hashed timer wheel. Scheduling and cancelling are O(1), advancing only visits the slots whose time has passed.
+	// Not thread safe, it is meant to be owned by a single thread.
+	class timer_wheel
+	{
+	public:
+		timer_wheel(uint32_t resolution = 100, size_t slotCount = 1024);
+		timer_wheel(const timer_wheel &other) = delete;
+		timer_wheel &operator=(const timer_wheel &other) = delete;
+		void schedule(timer_node *node, int64_t expiry);
+		void cancel(timer_node *node);
+		size_t advance(int64_t now, std::vector<timer_node*> &expired);
+		int32_t get_timeout(int64_t now, int32_t maxTimeout) const;
+		size_t get_count() const;
+	private:
+		std::vector<timer_node*> slots;
+		std::vector<uint64_t> occupied; // One bit per slot, set when the slot is not empty
+		std::vector<int64_t> earliest; // Lowest tick scheduled in each slot, never later than the real one
+		uint32_t resolution;
+		size_t mask;
+		int64_t currentTick;
+		size_t count;
+		size_t get_slot(int64_t tick) const;
+		int64_t get_tick(int64_t expiry) const;
+		void link(timer_node *node);
+		void unlink(timer_node *node);
+		int64_t find_next_tick() const;
+	};
+}
+
+#endif
@@ -0,0 +1,143 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef STW_UNIQUE_FUNCTION_HPP
+#define STW_UNIQUE_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace stw
+{
+	// Move-only replacement for std::function<void()>. Callables that fit in the inline buffer, such as
+	// lambdas capturing a few pointers, are stored without a heap allocation
+	class unique_function
+	{
+	public:
+		static constexpr size_t INLINE_SIZE = 48;
+
+		unique_function() noexcept : operations(nullptr) {}
+
+		template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, unique_function>>>
+		unique_function(F &&function)
+		{
+			using callable = std::decay_t<F>;
+
+			if constexpr (is_inline<callable>())
+			{
+				new (storage) callable(std::forward<F>(function));
+				operations = &inline_operations<callable>;
+			}
+			else
+			{
+				*reinterpret_cast<callable**>(storage) = new callable(std::forward<F>(function));
+				operations = &heap_operations<callable>;
+			}
+		}
+
+		unique_function(const unique_function &other) = delete;
+
+		unique_function(unique_function &&other) noexcept : operations(other.operations)
+		{
+			if(operations)
+			{
+				operations->move(storage, other.storage);
+				other.operations = nullptr;
+			}
+		}
+
+		unique_function &operator=(const unique_function &other) = delete;
+
+		unique_function &operator=(unique_function &&other) noexcept
+		{
+			if(this != &other)
+			{
+				reset();
+				operations = other.operations;
+
+				if(operations)
+				{
+					operations->move(storage, other.storage);
+					other.operations = nullptr;
+				}
+			}
+			return *this;
+		}
+
+		~unique_function()
+		{
+			reset();
+		}
+
+		void operator()()
+		{
+			operations->invoke(storage);
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return operations != nullptr;
+		}
+
+		void reset() noexcept
+		{
+			if(operations)
+			{
+				operations->destroy(storage);
+				operations = nullptr;
+			}
+		}
+	private:
+		struct operation_table
+		{
+			void (*invoke)(void *storage);
+			void (*move)(void *target, void *source); // Leaves source destroyed
+			void (*destroy)(void *storage);
+		};
+
+		template<typename C>
+		static constexpr bool is_inline()
+		{
+			return sizeof(C) <= INLINE_SIZE && alignof(C) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<C>;
+		}
+
+		template<typename C>
+		static constexpr operation_table inline_operations = {
+			[] (void *storage) { (*static_cast<C*>(storage))(); },
+			[] (void *target, void *source) {
+				new (target) C(std::move(*static_cast<C*>(source)));
+				static_cast<C*>(source)->~C();
+			},
+			[] (void *storage) { static_cast<C*>(storage)->~C(); }
+		};
+
+		template<typename C>
+		static constexpr operation_table heap_operations = {
+			[] (void *storage) { (**static_cast<C**>(storage))(); },
+			[] (void *target, void *source) { *static_cast<C**>(target) = *static_cast<C**>(source); },
+			[] (void *storage) { delete *static_cast<C**>(storage); }
+		};
+
+		alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+		const operation_table *operations;
+	};
+}
+
+#endif
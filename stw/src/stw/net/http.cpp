@@ -17,27 +17,242 @@
 // SOFTWARE.
 
 #include "http.hpp"
+#include "http_parser.hpp"
 #include "../system/string.hpp"
 #include <sstream>
 #include <filesystem>
 #include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <charconv>
 
 namespace stw
 {
-	static inline bool compare_case_insensitive(const std::string &str1, const std::string &str2) 
+	// Header names and methods are plain ASCII, so there is no need to go through the locale
+	static inline char to_lower_ascii(char c)
+	{
+		return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+	}
+
+	static inline bool compare_case_insensitive(std::string_view str1, std::string_view str2) 
 	{
 		if (str1.length() != str2.length())
 			return false;
 
 		for (size_t i = 0; i < str1.length(); ++i) 
 		{
-			if (std::tolower(static_cast<unsigned char>(str1[i])) != std::tolower(static_cast<unsigned char>(str2[i])))
+			if (to_lower_ascii(str1[i]) != to_lower_ascii(str2[i]))
 				return false;
 		}
 		return true; // All characters matched
 	}
 
+	http_headers::http_headers()
+	{
+		count = 0;
+		update_known();
+	}
+
+	std::string &http_headers::operator[](std::string_view name)
+	{
+		int32_t index = find(name);
+
+		if(index >= 0)
+			return entries[index].value;
+
+		return add(name, std::string_view()).value;
+	}
+
+	http_header &http_headers::add(std::string_view name, std::string_view value)
+	{
+		if(count == entries.size())
+			entries.emplace_back();
+
+		// Assigning reuses whatever the strings of a cleared entry already allocated
+		http_header &header = entries[count];
+		header.name.assign(name);
+		header.value.assign(value);
+
+		http_header_id id = get_id(name);
+
+		if(id != http_header_id_unknown && known[id] < 0)
+			known[id] = static_cast<int32_t>(count);
+
+		count++;
+		return header;
+	}
+
+	void http_headers::set(std::string_view name, std::string_view value)
+	{
+		erase(name);
+		add(name, value);
+	}
+
+	bool http_headers::contains(std::string_view name) const
+	{
+		return find(name) >= 0;
+	}
+
+	bool http_headers::contains(http_header_id id) const
+	{
+		return id > http_header_id_unknown && id < http_header_id_count && known[id] >= 0;
+	}
+
+	const std::string *http_headers::get(std::string_view name) const
+	{
+		int32_t index = find(name);
+		return index >= 0 ? &entries[index].value : nullptr;
+	}
+
+	const std::string *http_headers::get(http_header_id id) const
+	{
+		if(!contains(id))
+			return nullptr;
+		return &entries[known[id]].value;
+	}
+
+	size_t http_headers::erase(std::string_view name)
+	{
+		size_t removed = 0;
+		size_t i = 0;
+
+		while(i < count)
+		{
+			if(compare_case_insensitive(entries[i].name, name))
+			{
+				// Move the entry behind the live ones so its strings can be reused
+				std::rotate(entries.begin() + i, entries.begin() + i + 1, entries.begin() + count);
+				count--;
+				removed++;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		if(removed > 0)
+			update_known();
+
+		return removed;
+	}
+
+	void http_headers::clear()
+	{
+		count = 0;
+		update_known();
+	}
+
+	size_t http_headers::size() const
+	{
+		return count;
+	}
+
+	bool http_headers::empty() const
+	{
+		return count == 0;
+	}
+
+	http_header *http_headers::begin()
+	{
+		return entries.data();
+	}
+
+	http_header *http_headers::end()
+	{
+		return entries.data() + count;
+	}
+
+	const http_header *http_headers::begin() const
+	{
+		return entries.data();
+	}
+
+	const http_header *http_headers::end() const
+	{
+		return entries.data() + count;
+	}
+
+	http_header_id http_headers::get_id(std::string_view name)
+	{
+		// Only names with a matching length need to be compared
+		switch(name.size())
+		{
+			case 4:
+				if(compare_case_insensitive(name, "Host")) return http_header_id_host;
+				break;
+			case 5:
+				if(compare_case_insensitive(name, "Range")) return http_header_id_range;
+				break;
+			case 6:
+				if(compare_case_insensitive(name, "Accept")) return http_header_id_accept;
+				if(compare_case_insensitive(name, "Cookie")) return http_header_id_cookie;
+				if(compare_case_insensitive(name, "Expect")) return http_header_id_expect;
+				if(compare_case_insensitive(name, "Origin")) return http_header_id_origin;
+				break;
+			case 7:
+				if(compare_case_insensitive(name, "Upgrade")) return http_header_id_upgrade;
+				break;
+			case 10:
+				if(compare_case_insensitive(name, "Connection")) return http_header_id_connection;
+				if(compare_case_insensitive(name, "Keep-Alive")) return http_header_id_keep_alive;
+				if(compare_case_insensitive(name, "Set-Cookie")) return http_header_id_set_cookie;
+				if(compare_case_insensitive(name, "User-Agent")) return http_header_id_user_agent;
+				break;
+			case 12:
+				if(compare_case_insensitive(name, "Content-Type")) return http_header_id_content_type;
+				break;
+			case 13:
+				if(compare_case_insensitive(name, "Authorization")) return http_header_id_authorization;
+				if(compare_case_insensitive(name, "If-None-Match")) return http_header_id_if_none_match;
+				break;
+			case 14:
+				if(compare_case_insensitive(name, "Content-Length")) return http_header_id_content_length;
+				break;
+			case 15:
+				if(compare_case_insensitive(name, "Accept-Encoding")) return http_header_id_accept_encoding;
+				break;
+			case 17:
+				if(compare_case_insensitive(name, "Transfer-Encoding")) return http_header_id_transfer_encoding;
+				if(compare_case_insensitive(name, "If-Modified-Since")) return http_header_id_if_modified_since;
+				break;
+			default:
+				break;
+		}
+
+		return http_header_id_unknown;
+	}
+
+	int32_t http_headers::find(std::string_view name) const
+	{
+		http_header_id id = get_id(name);
+
+		if(id != http_header_id_unknown)
+			return known[id];
+
+		for(size_t i = 0; i < count; i++)
+		{
+			if(compare_case_insensitive(entries[i].name, name))
+				return static_cast<int32_t>(i);
+		}
+
+		return -1;
+	}
+
+	void http_headers::update_known()
+	{
+		for(size_t i = 0; i < http_header_id_count; i++)
+			known[i] = -1;
+
+		for(size_t i = 0; i < count; i++)
+		{
+			http_header_id id = get_id(entries[i].name);
+
+			if(id != http_header_id_unknown && known[id] < 0)
+				known[id] = static_cast<int32_t>(i);
+		}
+	}
+
 	http_request::http_request()
 	{
 		contentLength = 0;
@@ -54,41 +269,59 @@ namespace stw
 
 	bool http_request::parse(const std::string &requestBody, http_request &request)
 	{
-		if(request.headers.size() > 0)
-			request.headers.clear();
-		request.contentLength = 0;
+		return parse(requestBody.data(), requestBody.size(), request);
+	}
 
-		size_t pos = 0;
-		size_t end;
+	static void parse_cookies(std::string_view value, http_cookies &cookies)
+	{
+		while(value.size() > 0)
+		{
+			size_t separator = value.find(';');
+			std::string_view pair = value.substr(0, separator);
+			value = separator == std::string_view::npos ? std::string_view() : value.substr(separator + 1);
 
-		// Find the end of the headers
-		end = requestBody.find("\r\n\r\n", pos);
-		if (end == std::string::npos)
-			return false; // No end of header found
+			// Trim BOTH ends (leading/trailing whitespace/tabs)
+			size_t first = pair.find_first_not_of(" \t\r\n");
+			
+			if (first == std::string_view::npos) 
+				continue; // Skip empty segments
+			
+			size_t last = pair.find_last_not_of(" \t\r\n");
+			pair = pair.substr(first, last - first + 1);
 
-		// Parse the request line (first line before the headers)
-		size_t requestLineEnd = requestBody.find("\r\n", pos);
-		
-		if (requestLineEnd != std::string::npos && requestLineEnd < end) 
-		{
-			std::string requestLine = requestBody.substr(pos, requestLineEnd - pos);
-			std::istringstream requestStream(requestLine);
+			// Split by '='
+			size_t sep = pair.find('=');
 			
-			// Extract method/path/http version
-			std::string method;
-			requestStream >> method >> request.path >> request.httpVersion;
+			if (sep == std::string_view::npos) 
+				continue;
 
-			if (method.empty() || request.path.empty() || request.httpVersion.empty())
-				return false;
+			std::string_view cName = pair.substr(0, sep);
+			std::string_view cValue = pair.substr(sep + 1);
 			
-			request.method = get_http_method_from_string(method);
+			// Strip quotes if the browser quoted the value (e.g. ID="abc")
+			if (cValue.size() >= 2 && cValue.front() == '"' && cValue.back() == '"') 
+				cValue = cValue.substr(1, cValue.size() - 2);
 
-			pos = requestLineEnd + 2; // Move past the request line
-		} 
-		else
-		{
-			return false; // Invalid request line
+			cookies[std::string(cName)] = std::string(cValue);
 		}
+	}
+
+	bool http_request::parse(const char *data, size_t size, http_request &request)
+	{
+		if(request.headers.size() > 0)
+			request.headers.clear();
+		request.contentLength = 0;
+
+		http_request_view view;
+		bool hasContentLength = false;
+		bool hasTransferEncoding = false;
+
+		if(http_parser::parse_request(data, size, view) <= 0)
+			return false;
+
+		request.method = get_http_method_from_string(view.method);
+		request.path.assign(view.target);
+		request.httpVersion.assign(view.version);
 
 		try
 		{
@@ -103,91 +336,209 @@ namespace stw
 		if(!string::is_valid_utf8(request.path.data(), request.path.size()))
 			return false;
 
-		size_t lineEnd;
-		bool contentLengthSet = false;
-		
-		while ((lineEnd = requestBody.find("\r\n", pos)) != std::string::npos && pos < end) 
+		for(size_t i = 0; i < view.headerCount; i++)
 		{
-			// Get the header line
-			std::string line = requestBody.substr(pos, lineEnd - pos);
-			pos = lineEnd + 2; // Move to the next line
+			const http_header_view &header = view.headers[i];
+			http_header_id id = http_headers::get_id(header.name);
 
-			// Split the line into key and value
-			size_t delimiterPos = line.find(": ");
-			if (delimiterPos != std::string::npos) 
+			if(id == http_header_id_content_length)
+			{
+				uint64_t contentLength = 0;
+				auto result = std::from_chars(header.value.data(), header.value.data() + header.value.size(), contentLength);
+				
+				// A length that can't be trusted makes it impossible to tell where the next request starts
+				if(result.ec != std::errc() || result.ptr != header.value.data() + header.value.size())
+					return false;
+
+				// Repeating the same length is allowed, picking one of two different ones is not (RFC 9112 6.3)
+				if(hasContentLength && contentLength != request.contentLength)
+					return false;
+
+				request.contentLength = contentLength;
+				hasContentLength = true;
+			}
+			else if(id == http_header_id_transfer_encoding)
 			{
-				std::string key = line.substr(0, delimiterPos);
-				std::string value = line.substr(delimiterPos + 2); // Skip the ": "
+				// Only one is looked at when the body is read, a coding in a second one would go unnoticed
+				if(hasTransferEncoding)
+					return false;
 
-				std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { 
-					return std::tolower(c); 
-				});
+				hasTransferEncoding = true;
+			}
+			else if(id == http_header_id_cookie)
+			{
+				parse_cookies(header.value, request.cookies);
+				continue;
+			}
 
-				bool isCookie = false;
+			http_header &entry = request.headers.add(header.name, header.value);
+
+			for(char &c : entry.name)
+				c = to_lower_ascii(c);
+		}
 
-				if(compare_case_insensitive(key, "Content-Length"))
+		// A proxy in front of us may pick the other one to find the end of the body, which lets a request be smuggled inside another
+		if(hasContentLength && hasTransferEncoding)
+			return false;
+
+		return true;
+	}
+
+	static inline bool is_token_char(unsigned char c)
+	{
+		if(c >= 'a' && c <= 'z') return true;
+		if(c >= 'A' && c <= 'Z') return true;
+		if(c >= '0' && c <= '9') return true;
+		return std::strchr("!#$%&'*+-.^_`|~", c) != nullptr && c != 0;
+	}
+
+	http_request_scanner::http_request_scanner()
+	{
+		reset();
+	}
+
+	void http_request_scanner::reset()
+	{
+		headerEnd = 0;
+		state = scan_state_method;
+		offset = 0;
+		fieldStart = 0;
+	}
+
+	http_scan_result http_request_scanner::scan(const char *data, size_t size)
+	{
+		constexpr size_t MAX_METHOD_LENGTH = 16;
+
+		if(state == scan_state_done)
+			return http_scan_result_complete;
+
+		if(state == scan_state_error)
+			return http_scan_result_error;
+
+		while(offset < size)
+		{
+			unsigned char c = static_cast<unsigned char>(data[offset]);
+
+			switch(state)
+			{
+				case scan_state_method:
 				{
-					try 
+					if(c == ' ')
 					{
-						request.contentLength = std::stoull(value);
-						contentLengthSet = true;
-					} 
-					catch (...) 
+						if(offset == 0)
+							goto error;
+						fieldStart = offset + 1;
+						state = scan_state_target;
+					}
+					else if(!is_token_char(c) || offset >= MAX_METHOD_LENGTH)
+					{
+						goto error;
+					}
+					break;
+				}
+				case scan_state_target:
+				{
+					if(c == ' ')
 					{
-						request.contentLength = 0;
-						contentLengthSet = true;
+						if(offset == fieldStart)
+							goto error;
+						fieldStart = offset + 1;
+						state = scan_state_version;
 					}
+					else if(c < 0x20 || c == 0x7F)
+					{
+						goto error;
+					}
+					break;
 				}
-				else if(compare_case_insensitive(key, "Cookie"))
+				case scan_state_version:
 				{
-					isCookie = true;
-					std::istringstream cookieStream(value);
-					std::string cookiePair;
+					// Only HTTP/x.y is accepted
+					size_t index = offset - fieldStart;
 
-					while (std::getline(cookieStream, cookiePair, ';')) 
+					if(index < 5)
 					{
-						// Trim BOTH ends (leading/trailing whitespace/tabs)
-						size_t first = cookiePair.find_first_not_of(" \t\r\n");
-						
-						if (first == std::string::npos) 
-							continue; // Skip empty segments
-						
-						size_t last = cookiePair.find_last_not_of(" \t\r\n");
-						std::string cleanPair = cookiePair.substr(first, (last - first + 1));
-
-						// Split by '='
-						size_t sep = cleanPair.find('=');
-						
-						if (sep != std::string::npos) 
-						{
-							std::string cName = cleanPair.substr(0, sep);
-							std::string cValue = cleanPair.substr(sep + 1);
-							
-							// Strip quotes if the browser quoted the value (e.g. ID="abc")
-							if (cValue.size() >= 2 && cValue.front() == '"' && cValue.back() == '"') 
-							{
-								cValue = cValue.substr(1, cValue.size() - 2);
-							}
-
-							request.cookies[std::move(cName)] = std::move(cValue);
-						}
+						if(c != "HTTP/"[index])
+							goto error;
 					}
+					else if(index == 5 || index == 7)
+					{
+						if(c < '0' || c > '9')
+							goto error;
+					}
+					else if(index == 6)
+					{
+						if(c != '.')
+							goto error;
+					}
+					else if(c == '\r')
+					{
+						state = scan_state_request_line_lf;
+					}
+					else
+					{
+						goto error;
+					}
+					break;
 				}
+				case scan_state_request_line_lf:
+				{
+					if(c != '\n')
+						goto error;
+					state = scan_state_line_start;
+					break;
+				}
+				case scan_state_line_start:
+				{
+					state = c == '\r' ? scan_state_end_lf : scan_state_header_line;
+					break;
+				}
+				case scan_state_header_line:
+				{
+					// Header lines are parsed later, all that matters here is where they end
+					const void *cr = std::memchr(data + offset, '\r', size - offset);
 
-				// Insert into the headers map
-				if(!isCookie)
-					request.headers[std::move(key)] = std::move(value);
+					if(!cr)
+					{
+						offset = size;
+						return http_scan_result_incomplete;
+					}
+
+					offset = static_cast<const char*>(cr) - data;
+					state = scan_state_header_line_lf;
+					break;
+				}
+				case scan_state_header_line_lf:
+				{
+					if(c != '\n')
+						goto error;
+					state = scan_state_line_start;
+					break;
+				}
+				case scan_state_end_lf:
+				{
+					if(c != '\n')
+						goto error;
+					headerEnd = offset + 1;
+					offset++;
+					state = scan_state_done;
+					return http_scan_result_complete;
+				}
+				default:
+					goto error;
 			}
+
+			offset++;
 		}
 
-		// Just in case that there might not be a content-length header
-		if(!contentLengthSet)
-			request.contentLength = 0;
+		return http_scan_result_incomplete;
 
-		return true;
+	error:
+		state = scan_state_error;
+		return http_scan_result_error;
 	}
 
-	http_method http_request::get_http_method_from_string(const std::string &method)
+	http_method http_request::get_http_method_from_string(std::string_view method)
 	{
         if(compare_case_insensitive(method, "GET"))
             return http_method_get;
@@ -18,29 +18,94 @@
 
 #include "http_config.hpp"
 #include "../system/ini_reader.hpp"
+#include "../system/string.hpp"
 #include <iostream>
 
 namespace stw
 {
+	// Reads a list such as "0-3,8,10-11"
+	static bool parse_cpu_list(const std::string &value, std::vector<uint32_t> &cpus)
+	{
+		cpus.clear();
+
+		for (const std::string &part : stw::string::split(value, ','))
+		{
+			std::string range = stw::string::trim(part);
+
+			if (range.empty())
+				continue;
+
+			std::vector<std::string> bounds = stw::string::split(range, '-', 2);
+			uint32_t first = 0;
+			uint32_t last = 0;
+
+			if (!stw::string::try_parse_uint32(stw::string::trim(bounds[0]), first))
+				return false;
+
+			if (bounds.size() == 1)
+				last = first;
+			else if (!stw::string::try_parse_uint32(stw::string::trim(bounds[1]), last) || last < first)
+				return false;
+
+			for (uint32_t cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		}
+
+		return true;
+	}
+
 	void http_config::load_default() 
 	{
 		port = 8080;
 		maxHeaderSize = 16384;
+		maxBodySize = 0;
 		bindAddress = "0.0.0.0";
 		publicHtmlPath = "www/public_html";
 		privateHtmlPath = "www/private_html";
 		hostName = "localhost";
+		reusePort = false;
+		edgeTriggered = false;
+		rebalanceConnections = false;
+		workerCount = 0;
+		threadPoolSize = 0;
+		workerCpus.clear();
+		threadPoolCpus.clear();
+		processCount = 0;
+		reloadSocketPath.clear();
+		firstByteTimeout = 15;
+		headerTimeout = 20;
+		bodyTimeout = 30;
+		writeTimeout = 30;
+		drainTimeout = 30;
 	}
 
 	bool http_config::load_from_file(const std::string &filePath)
 	{
+		// Settings that are not present in the file keep their default value
+		load_default();
+
 		ini_reader reader;
 		reader.add_required_field("port", ini_reader::field_type_number);
 		reader.add_required_field("max_header_size", ini_reader::field_type_number);
+		reader.add_required_field("max_body_size", ini_reader::field_type_number);
 		reader.add_required_field("bind_address", ini_reader::field_type_string);
 		reader.add_required_field("public_html_path", ini_reader::field_type_string);
 		reader.add_required_field("private_html_path", ini_reader::field_type_string);
 		reader.add_required_field("host_name", ini_reader::field_type_string);
+		reader.add_required_field("reuse_port", ini_reader::field_type_boolean);
+		reader.add_required_field("edge_triggered", ini_reader::field_type_boolean);
+		reader.add_required_field("rebalance_connections", ini_reader::field_type_boolean);
+		reader.add_required_field("worker_count", ini_reader::field_type_number);
+		reader.add_required_field("thread_pool_size", ini_reader::field_type_number);
+		reader.add_required_field("worker_cpus", ini_reader::field_type_string);
+		reader.add_required_field("thread_pool_cpus", ini_reader::field_type_string);
+		reader.add_required_field("process_count", ini_reader::field_type_number);
+		reader.add_required_field("reload_socket_path", ini_reader::field_type_string);
+		reader.add_required_field("first_byte_timeout", ini_reader::field_type_number);
+		reader.add_required_field("header_timeout", ini_reader::field_type_number);
+		reader.add_required_field("body_timeout", ini_reader::field_type_number);
+		reader.add_required_field("write_timeout", ini_reader::field_type_number);
+		reader.add_required_field("drain_timeout", ini_reader::field_type_number);
 
 		try
 		{
@@ -55,6 +120,39 @@ namespace stw
 				return false;
 			if(!fields["max_header_size"].try_get_uint32(maxHeaderSize))
 				return false;
+			if(fields.contains("max_body_size") && !fields["max_body_size"].try_get_uint64(maxBodySize))
+				return false;
+			if(fields.contains("reuse_port") && !fields["reuse_port"].try_get_boolean(reusePort))
+				return false;
+
+			if(fields.contains("edge_triggered") && !fields["edge_triggered"].try_get_boolean(edgeTriggered))
+				return false;
+			if(fields.contains("rebalance_connections") && !fields["rebalance_connections"].try_get_boolean(rebalanceConnections))
+				return false;
+
+			if(fields.contains("worker_count") && !fields["worker_count"].try_get_uint32(workerCount))
+				return false;
+			if(fields.contains("thread_pool_size") && !fields["thread_pool_size"].try_get_uint32(threadPoolSize))
+				return false;
+			if(fields.contains("worker_cpus") && !parse_cpu_list(fields["worker_cpus"].value, workerCpus))
+				return false;
+			if(fields.contains("thread_pool_cpus") && !parse_cpu_list(fields["thread_pool_cpus"].value, threadPoolCpus))
+				return false;
+			if(fields.contains("process_count") && !fields["process_count"].try_get_uint32(processCount))
+				return false;
+			if(fields.contains("reload_socket_path"))
+				reloadSocketPath = fields["reload_socket_path"].value;
+
+			if(fields.contains("first_byte_timeout") && !fields["first_byte_timeout"].try_get_uint32(firstByteTimeout))
+				return false;
+			if(fields.contains("header_timeout") && !fields["header_timeout"].try_get_uint32(headerTimeout))
+				return false;
+			if(fields.contains("body_timeout") && !fields["body_timeout"].try_get_uint32(bodyTimeout))
+				return false;
+			if(fields.contains("write_timeout") && !fields["write_timeout"].try_get_uint32(writeTimeout))
+				return false;
+			if(fields.contains("drain_timeout") && !fields["drain_timeout"].try_get_uint32(drainTimeout))
+				return false;
 			
 			return true;
 		}
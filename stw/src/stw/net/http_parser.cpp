@@ -0,0 +1,260 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "http_parser.hpp"
+#include <array>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+	#define STW_HTTP_PARSER_SSE42
+	#include <nmmintrin.h>
+#endif
+
+namespace stw::http_parser
+{
+	static constexpr std::array<bool,256> create_token_table()
+	{
+		std::array<bool,256> table = {};
+		
+		for(int c = '0'; c <= '9'; c++)
+			table[c] = true;
+		for(int c = 'a'; c <= 'z'; c++)
+			table[c] = true;
+		for(int c = 'A'; c <= 'Z'; c++)
+			table[c] = true;
+		for(char c : std::string_view("!#$%&'*+-.^_`|~"))
+			table[static_cast<unsigned char>(c)] = true;
+
+		return table;
+	}
+
+	static constexpr std::array<bool,256> tokenTable = create_token_table();
+
+	static inline bool is_token_char(char c)
+	{
+		return tokenTable[static_cast<unsigned char>(c)];
+	}
+
+	// Anything below 0x20 except horizontal tab, and DEL
+	static inline bool is_value_delimiter(char c)
+	{
+		unsigned char u = static_cast<unsigned char>(c);
+		return (u < 0x20 && u != '\t') || u == 0x7F;
+	}
+
+	static inline bool is_target_delimiter(char c)
+	{
+		unsigned char u = static_cast<unsigned char>(c);
+		return u <= 0x20 || u == 0x7F;
+	}
+
+	// Pairs of inclusive ranges for _mm_cmpestri, padded to 16 bytes because they are loaded as a whole
+	alignas(16) static const char tokenDelimiterRanges[16] = { '\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xFF' };
+	alignas(16) static const char valueDelimiterRanges[16] = { '\x00', '\x08', '\x0A', '\x1F', '\x7F', '\x7F' };
+	alignas(16) static const char targetDelimiterRanges[16] = { '\x00', ' ', '\x7F', '\x7F' };
+
+#if defined(STW_HTTP_PARSER_SSE42)
+	// Skips 16 bytes at a time until one of them falls in the given ranges. The last few bytes are left to the caller.
+	__attribute__((target("sse4.2")))
+	static const char *skip_sse42(const char *p, const char *end, const char *ranges, int rangesSize)
+	{
+		__m128i ranges16 = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges));
+
+		while(end - p >= 16)
+		{
+			__m128i data16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			int index = _mm_cmpestri(ranges16, rangesSize, data16, 16, _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+
+			if(index != 16)
+				return p + index;
+
+			p += 16;
+		}
+
+		return p;
+	}
+
+	static bool detect_sse42()
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.2");
+	}
+
+	static const bool hasSse42 = detect_sse42();
+#endif
+
+	// Returns the first byte that may be in the given ranges. The caller still checks every byte from there on,
+	// so the result is only a starting point and ranges may be a superset of what the caller stops at.
+	static inline const char *skip(const char *p, const char *end, const char *ranges, int rangesSize)
+	{
+	#if defined(STW_HTTP_PARSER_SSE42)
+		if(hasSse42)
+			return skip_sse42(p, end, ranges, rangesSize);
+	#endif
+		(void)end;
+		(void)ranges;
+		(void)rangesSize;
+		return p;
+	}
+
+	bool is_accelerated()
+	{
+	#if defined(STW_HTTP_PARSER_SSE42)
+		return hasSse42;
+	#else
+		return false;
+	#endif
+	}
+
+	int64_t parse_request(const char *data, size_t size, http_request_view &request)
+	{
+		const char *p = data;
+		const char *end = data + size;
+		const char *start = p;
+
+		request.headerCount = 0;
+
+		// Method
+		while(p < end && *p != ' ')
+		{
+			if(!is_token_char(*p))
+				return PARSE_ERROR;
+			p++;
+		}
+
+		if(p == end)
+			return PARSE_INCOMPLETE;
+		if(p == start)
+			return PARSE_ERROR;
+
+		request.method = std::string_view(start, p - start);
+		start = ++p;
+
+		// Target
+		p = skip(p, end, targetDelimiterRanges, 4);
+
+		while(p < end && !is_target_delimiter(*p))
+			p++;
+
+		if(p == end)
+			return PARSE_INCOMPLETE;
+		if(*p != ' ' || p == start)
+			return PARSE_ERROR;
+
+		request.target = std::string_view(start, p - start);
+		start = ++p;
+
+		// Version, only HTTP/x.y followed by CRLF
+		constexpr std::string_view versionPrefix = "HTTP/";
+
+		for(size_t i = 0; i < 10; i++)
+		{
+			if(p + i == end)
+				return PARSE_INCOMPLETE;
+
+			char c = p[i];
+			bool valid;
+
+			if(i < 5)
+				valid = c == versionPrefix[i];
+			else if(i == 5 || i == 7)
+				valid = c >= '0' && c <= '9';
+			else if(i == 6)
+				valid = c == '.';
+			else if(i == 8)
+				valid = c == '\r';
+			else
+				valid = c == '\n';
+
+			if(!valid)
+				return PARSE_ERROR;
+		}
+
+		request.version = std::string_view(start, 8);
+		p += 10;
+
+		// Headers
+		while(true)
+		{
+			if(p == end)
+				return PARSE_INCOMPLETE;
+
+			if(*p == '\r')
+			{
+				if(p + 1 == end)
+					return PARSE_INCOMPLETE;
+				if(p[1] != '\n')
+					return PARSE_ERROR;
+				p += 2;
+				return static_cast<int64_t>(p - data);
+			}
+
+			if(request.headerCount == http_request_view::MAX_HEADERS)
+				return PARSE_ERROR;
+
+			// Name
+			start = p;
+
+			while(true)
+			{
+				p = skip(p, end, tokenDelimiterRanges, 16);
+
+				if(p == end)
+					return PARSE_INCOMPLETE;
+				if(*p == ':')
+					break;
+				if(!is_token_char(*p))
+					return PARSE_ERROR;
+				p++;
+			}
+
+			if(p == start)
+				return PARSE_ERROR;
+
+			std::string_view name(start, p - start);
+			p++;
+
+			while(p < end && (*p == ' ' || *p == '\t'))
+				p++;
+
+			// Value
+			start = p;
+			p = skip(p, end, valueDelimiterRanges, 6);
+
+			while(p < end && !is_value_delimiter(*p))
+				p++;
+
+			if(p == end)
+				return PARSE_INCOMPLETE;
+			if(*p != '\r')
+				return PARSE_ERROR;
+			if(p + 1 == end)
+				return PARSE_INCOMPLETE;
+			if(p[1] != '\n')
+				return PARSE_ERROR;
+
+			const char *valueEnd = p;
+
+			while(valueEnd > start && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+				valueEnd--;
+
+			http_header_view &header = request.headers[request.headerCount++];
+			header.name = name;
+			header.value = std::string_view(start, valueEnd - start);
+			p += 2;
+		}
+	}
+}
@@ -18,28 +18,102 @@
 
 #include "http_server.hpp"
 #include "../system/signal.hpp"
+#include "../system/runtime.hpp"
 #include "../system/string.hpp"
 #include "../system/stringstream.hpp"
 #include <memory>
+#include <new>
 #include <cstring>
 #include <sstream>
 #include <algorithm>
+#include <charconv>
 #include <future>
 #include <iostream>
 
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+    #include <signal.h>
+#endif
+
 namespace stw
 {
+    // Worker that owns the calling thread, nullptr on any other thread
+    static thread_local http_worker_context *gCurrentWorker = nullptr;
+
+    // Response content is read on the worker thread. A stream that throws, such as a producer whose callback fails,
+    // must not take the worker down with it. Returns false when it threw
+    static bool read_content(stw::stream *content, void *buffer, size_t size, int64_t &bytesRead)
+    {
+        try
+        {
+            bytesRead = content->read(buffer, size);
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to read response content: " << e.what() << '\n';
+            return false;
+        }
+    }
+
+    static bool contains_event(const std::vector<stw::poll_event_result> &events, int32_t fd)
+    {
+        for (const stw::poll_event_result &ev : events)
+        {
+            if (ev.fd == fd)
+                return true;
+        }
+
+        return false;
+    }
+
+    // Owns a coroutine handler from its start until its response is handed to the completion
+    struct http_task_driver
+    {
+        struct promise_type
+        {
+            http_task_driver get_return_object() const noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() const noexcept {}
+            void unhandled_exception() const noexcept {}
+        };
+    };
+
+    static http_task_driver run_task(stw::task<http_response> handler, http_completion completion)
+    {
+        try
+        {
+            http_response response = co_await handler;
+            completion.complete(std::move(response));
+        }
+        catch (const std::exception &e)
+        {
+            // Letting the completion go without a response answers with a 500
+        }
+    }
+
     http_server::http_server()
     {
         isRunning.store(false);
+        processStats = nullptr;
+        processStatsCount = 0;
+        isStatsShared = false;
+        processIndex = 0;
+        requestBase = 0;
+        isChildProcess = false;
 
-        threadPool = std::make_unique<stw::thread_pool>();
+        poller = stw::poller::create();
 
         stw::signal::register_handler([this](int32_t n)
                                       {
             if(n == SIGINT || n == SIGTERM)
             {
                 isRunning.store(false);
+                // Wakes up the accept loop, writing to the notifier is safe within a signal handler
+                poller->notify();
             #if defined(_WIN32) || defined(__APPLE__) || defined(__FreeBSD__)
                 exit(0);
             #endif
@@ -52,6 +126,11 @@ namespace stw
     #endif
     }
 
+    http_server::~http_server()
+    {
+        free_stats();
+    }
+
     int http_server::run(const stw::http_config &config)
     {
         if (isRunning.load())
@@ -59,8 +138,30 @@ namespace stw
 
 		this->config = config;
 
-		if(!onRequest)
-			throw std::runtime_error("onRequest callback is not set"); 
+		if(!onRequest && !onRequestAsync && !onRequestTask)
+			throw std::runtime_error("None of the onRequest, onRequestAsync or onRequestTask callbacks is set");
+
+        // A server that still runs on the reload socket hands over its listeners, it drains and exits afterwards
+        if (!config.reloadSocketPath.empty() && listener_handoff::receive(config.reloadSocketPath, inheritedListeners))
+            std::cout << "Took over " << inheritedListeners.size() << " listening sockets from the previous server\n";
+
+    #if !defined(_WIN32)
+        if (config.processCount > 1)
+            return run_supervisor();
+    #endif
+
+        if (!allocate_stats(1, false))
+            return 4;
+
+        processIndex = 0;
+        return run_workers();
+    }
+
+    // Binds the shared listener, it isn't added to a poller yet
+    int http_server::open_listener()
+    {
+        if (take_inherited_listener(listener))
+            return 0;
 
         if (!listener.bind(config.bindAddress, config.port))
             return 2;
@@ -68,40 +169,216 @@ namespace stw
         if (!listener.listen(4096))
             return 3;
 
-        listener.set_timeout(1);
+        listener.set_blocking(false);
         listener.set_no_delay(true);
+        return 0;
+    }
 
-        isRunning.store(true);
+    // The inherited listeners are bound and listening already, they only need a new owner
+    bool http_server::take_inherited_listener(stw::socket &target)
+    {
+        while (!inheritedListeners.empty())
+        {
+            socket_handle fd = inheritedListeners.front();
+            inheritedListeners.erase(inheritedListeners.begin());
+
+            if (target.adopt(fd))
+                return true;
+
+            stw::socket_t handle = {};
+            handle.fd = fd;
+            stw::socket(handle).close();
+        }
+
+        return false;
+    }
+
+    // Lets the next server process take over the listeners. Inherited listeners that weren't needed are closed first,
+    // connections waiting on them are lost
+    void http_server::open_handoff()
+    {
+        while (!inheritedListeners.empty())
+        {
+            stw::socket_t handle = {};
+            handle.fd = inheritedListeners.back();
+            inheritedListeners.pop_back();
+            stw::socket(handle).close();
+        }
+
+        if (config.reloadSocketPath.empty())
+            return;
+
+        if (handoff.listen(config.reloadSocketPath))
+            poller->add(handoff.get_file_descriptor(), stw::poll_event_read);
+        else
+            std::cerr << "Failed to listen on reload socket " << config.reloadSocketPath << '\n';
+    }
+
+    // Passes the listeners to the process that connected to the reload socket. This one stops once it succeeded
+    bool http_server::hand_off(const std::vector<std::unique_ptr<http_worker_context>> &workers)
+    {
+        std::vector<socket_handle> descriptors;
+
+        if (listener.get_file_descriptor() != INVALID_SOCKET_HANDLE)
+            descriptors.push_back(listener.get_file_descriptor());
+
+        // In reuse port mode every worker has a listener of its own
+        for (const auto &worker : workers)
+        {
+            if (worker->listener.get_file_descriptor() != INVALID_SOCKET_HANDLE)
+                descriptors.push_back(worker->listener.get_file_descriptor());
+        }
+
+        if (!handoff.send(descriptors))
+            return false;
 
-        const size_t threadCount = std::thread::hardware_concurrency();
+        poller->remove(handoff.get_file_descriptor());
+        handoff.close(false);
+        isRunning.store(false);
+        std::cout << "Handed over " << descriptors.size() << " listening sockets, draining\n";
+        return true;
+    }
+
+    // Runs the workers and the accept loop of this process until the server stops. In prefork mode a child
+    // process gets here with the listener it inherited from the parent
+    int http_server::run_workers()
+    {
+        // A restarted process continues the count of the one it replaces
+        requestBase = processStats[processIndex].requestCount.load(std::memory_order_relaxed);
+
+        size_t threadCount = config.workerCount > 0 ? config.workerCount : std::thread::hardware_concurrency();
+
+        if (threadCount == 0)
+            threadCount = 1;
+
+        // Created here instead of in the constructor, its size and placement come from the configuration
+        threadPool = std::make_unique<stw::thread_pool>(config.threadPoolSize, 4096, config.threadPoolCpus);
 
         std::vector<std::unique_ptr<http_worker_context>> workers;
 
         for (size_t i = 0; i < threadCount; ++i)
         {
             workers.push_back(std::make_unique<http_worker_context>());
-            workers.back()->thread = std::thread(&http_server::worker_update, this, workers.back().get());
+            workers.back()->edgeTriggered = config.edgeTriggered && workers.back()->poller->supports_edge_triggered();
+            workers.back()->firstByteTimeout = config.firstByteTimeout;
+            workers.back()->bodyTimeout = config.bodyTimeout;
+            workers.back()->threadPool = threadPool.get();
+
+            if (!config.workerCpus.empty())
+                workers.back()->cpus = { config.workerCpus[i % config.workerCpus.size()] };
+        }
+
+        if(config.rebalanceConnections && threadCount > 1)
+        {
+            for (auto &worker : workers)
+            {
+                for (auto &sibling : workers)
+                {
+                    if (sibling.get() != worker.get())
+                        worker->siblings.push_back(sibling.get());
+                }
+            }
+        }
+
+        if(config.reusePort)
+        {
+            // Each worker accepts on its own socket, the kernel spreads incoming connections between them
+            for (auto &worker : workers)
+            {
+                if (!take_inherited_listener(worker->listener))
+                {
+                    if (!worker->listener.bind(config.bindAddress, config.port, true))
+                        return 2;
+
+                    if (!worker->listener.listen(4096))
+                        return 3;
+                }
+
+                worker->listener.set_blocking(false);
+                worker->listener.set_no_delay(true);
+                worker->poller->add(worker->listener.get_file_descriptor(), stw::poll_event_read);
+            }
         }
+        else
+        {
+            if (!isChildProcess)
+            {
+                int result = open_listener();
+
+                if (result != 0)
+                    return result;
+            }
+
+            poller->add(listener.get_file_descriptor(), stw::poll_event_read);
+        }
+
+        // In prefork mode the parent owns the listeners and the reload socket
+        if (!isChildProcess)
+            open_handoff();
+
+        isRunning.store(true);
+
+        for (auto &worker : workers)
+            worker->thread = std::thread(&http_server::worker_update, this, worker.get());
 
-        std::cout << "Server started listening on http://" << config.bindAddress << ":" << config.port << '\n';
+        if (!isChildProcess)
+            std::cout << "Server started listening on http://" << config.bindAddress << ":" << config.port << '\n';
 
-        size_t nextWorker = 0;
+        uint64_t randomState = static_cast<uint64_t>(stw::date_time::get_now().get_time_since_epoch_in_milliseconds()) | 1;
+        std::vector<stw::poll_event_result> events;
+        std::vector<stw::socket> clients;
+        constexpr size_t MAX_ACCEPT_BATCH = 64;
+        clients.reserve(MAX_ACCEPT_BATCH);
 
+        // In reuse port mode the workers accept by themselves, the poller is only used to wait for a shutdown signal
         while (isRunning.load())
         {
+            events.clear();
+            publish_stats(workers);
+
+            if (poller->wait(events, 1000) <= 0)
+                continue;
+
+            if (handoff.get_file_descriptor() != INVALID_SOCKET_HANDLE && contains_event(events, handoff.get_file_descriptor()))
+            {
+                if (hand_off(workers))
+                    break;
+            }
+
+            if (config.reusePort)
+                continue;
+
 			try
 			{
-				auto client = std::make_shared<stw::socket>();
+                while (true)
+                {
+                    clients.clear();
+                    size_t count = listener.accept_batch(clients, MAX_ACCEPT_BATCH);
+                    int64_t now = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
 
-				if (listener.accept(client.get()))
-				{
-					client->set_blocking(false);
-					client->set_no_delay(true);
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        // Power of two choices, the less loaded of two random workers gets the connection. Looking at
+                        // every worker would make them all pick the same one until its load shows the new connections
+                        randomState ^= randomState << 13;
+                        randomState ^= randomState >> 7;
+                        randomState ^= randomState << 17;
+
+                        size_t firstIndex = randomState % threadCount;
+                        size_t secondIndex = threadCount > 1 ? (firstIndex + 1 + (randomState >> 32) % (threadCount - 1)) % threadCount : firstIndex;
+                        http_worker_context *first = workers[firstIndex].get();
+                        http_worker_context *second = workers[secondIndex].get();
+
+                        if (second->get_load(now) < first->get_load(now))
+                            std::swap(first, second);
+
+                        if(!first->enqueue(clients[i]) && (first == second || !second->enqueue(clients[i])))
+                            clients[i].close();
+                    }
 
-					if(!workers[nextWorker]->enqueue(client))
-						client->close();
-					nextWorker = (nextWorker + 1) % threadCount;
-				}
+                    if (count < MAX_ACCEPT_BATCH)
+                        break;
+                }
 			}
 			catch(const std::bad_alloc &e)
 			{
@@ -112,255 +389,845 @@ namespace stw
 			}
         }
 
-		if(onClose)
+        // No new connections from here on, the next server process or the kernel gets them
+        if (listener.get_file_descriptor() != INVALID_SOCKET_HANDLE)
+        {
+            poller->remove(listener.get_file_descriptor());
+            listener.close();
+        }
+
+        if (!isChildProcess)
+            handoff.close(true);
+
+		if(onClose && !isChildProcess)
 			onClose();
 
+        // Workers finish the requests they have in parallel, idle connections are closed right away
+        int64_t drainDeadline = stw::date_time::get_now().get_time_since_epoch_in_milliseconds() + static_cast<int64_t>(config.drainTimeout) * 1000;
+
         for (auto &worker : workers)
         {
-            worker->stopFlag = true;
+            if (config.drainTimeout == 0)
+                worker->stopFlag = true;
+            else
+                worker->drainDeadline.store(drainDeadline, std::memory_order_relaxed);
+
             worker->poller->notify();
+        }
+
+        for (auto &worker : workers)
+        {
 			if(worker->thread.joinable())
             	worker->thread.join();
 			
-			std::shared_ptr<stw::socket> orphanedSocket;
-			while (worker->queue.try_dequeue(orphanedSocket)) 
+			http_queued_connection orphanedConnection;
+			while (worker->queue.try_dequeue(orphanedConnection)) 
 			{
-				orphanedSocket.reset();
+				stw::socket(orphanedConnection.handle).close();
 			}
         }
 
+        // Offloaded requests and coroutine work still point at their worker and context. The pool runs what it has
+        // queued and joins its threads here, after that nothing can touch the workers before they are destroyed
+        threadPool.reset();
+
+        publish_stats(workers);
         return 0;
     }
 
-    void http_server::worker_update(http_worker_context *worker)
+    // Forks the worker processes and restarts any that die until the server is stopped. The parent binds the
+    // listener once and only waits for signals and children, it never runs workers itself
+    int http_server::run_supervisor()
     {
-        std::vector<stw::poll_event_result> activeEvents;
-        activeEvents.reserve(1024);
-
-        while (!worker->stopFlag.load())
+    #if defined(_WIN32)
+        return 1;
+    #else
+        if (!config.reusePort)
         {
-			if(activeEvents.size() > 0)
-				activeEvents.clear();
+            int result = open_listener();
 
-			int32_t eventCount = worker->poller->wait(activeEvents, 1000);
+            if (result != 0)
+                return result;
+        }
 
-			auto now = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
+        // Each process binds listeners of its own in reuse port mode, the supervisor has none it could hand over
+        if (!config.reusePort)
+            open_handoff();
+        else if (!config.reloadSocketPath.empty())
+            std::cerr << "The reload socket is not supported with reuse_port and more than one process\n";
 
-			if((now - worker->lastCleanup) > 5000)
-			{
-				for (auto it = worker->contexts.begin(); it != worker->contexts.end();)
-				{
-					auto context = it->second;
-
-					if(context->isLocked.load())
-					{
-						++it;
-						continue;
-					}
-
-					if((now - context->lastActivity) > (worker->keepAliveTime * 1000))
-					{
-						int32_t fd = context->connection->get_file_descriptor();
-						worker->poller->remove(fd);
-						context->connection->close();
-						it = worker->contexts.erase(it);
-						continue;
-					}
-					else
-					{
-						++it;
-					}
-				}
+        size_t processCount = config.processCount;
 
-				worker->lastCleanup = now;
-			}
+        if (!allocate_stats(processCount, true))
+            return 4;
 
-			std::shared_ptr<stw::socket> newConnection;
+        std::vector<pid_t> children(processCount, -1);
+        std::vector<int64_t> startTimes(processCount, 0);
+        std::vector<int64_t> restartTimes(processCount, 0);
+        std::vector<stw::poll_event_result> events;
 
-            while (worker->queue.try_dequeue(newConnection))
-            {
-                int32_t fd = newConnection->get_file_descriptor();
-                worker->contexts[fd] = std::make_shared<http_context>(newConnection);
-                worker->poller->add(fd, stw::poll_event_read);
-            }
+        isRunning.store(true);
 
-			if(eventCount == 0)
-				continue;
+        std::cout << "Server started listening on http://" << config.bindAddress << ":" << config.port << " with " << processCount << " processes\n";
 
-            for (const auto &ev : activeEvents)
+        while (isRunning.load())
+        {
+            int64_t now = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
+
+            for (size_t i = 0; i < processCount; ++i)
             {
-                auto it = worker->contexts.find(ev.fd);
-                
-				if (it == worker->contexts.end())
+                if (children[i] > 0 || now < restartTimes[i])
                     continue;
 
-                std::shared_ptr<http_context> context = it->second;
+                // Anything still buffered would be written by the child as well
+                std::cout.flush();
+                std::cerr.flush();
+
+                // Nothing but this thread runs in the parent, so the child starts from a consistent state
+                pid_t pid = fork();
 
-                if (ev.flags & stw::poll_event_error || ev.flags & stw::poll_event_disconnect)
+                if (pid == 0)
                 {
-					if(context->isLocked.load())
-						continue;
+                    isChildProcess = true;
+                    processIndex = static_cast<int32_t>(i);
+                    handoff.close(false);
+                    // The poller of the parent is an epoll or kqueue instance, which the child would share with it
+                    poller = stw::poller::create();
+                    int result = run_workers();
+                    std::cout.flush();
+                    _exit(result);
+                }
 
-                    worker->remove(context, "disconnected by client");
+                if (pid < 0)
+                {
+                    std::cerr << "Failed to start worker process: " << strerror(errno) << '\n';
+                    restartTimes[i] = now + 1000;
                     continue;
                 }
 
-                if (ev.flags & stw::poll_event_read)
-				{
-					if(context->isLocked.load())
-						continue;
-                    on_read(worker, context->connection->get_file_descriptor());
-				}
+                children[i] = pid;
+                startTimes[i] = now;
+                processStats[i].processId.store(pid, std::memory_order_relaxed);
+            }
 
-                if (ev.flags & stw::poll_event_write)
-				{
-					if(context->isLocked.load())
-						continue;
-                    on_write(worker, context->connection->get_file_descriptor());
-				}
+            int status = 0;
+            pid_t pid;
+
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                for (size_t i = 0; i < processCount; ++i)
+                {
+                    if (children[i] != pid)
+                        continue;
+
+                    children[i] = -1;
+                    processStats[i].processId.store(0, std::memory_order_relaxed);
+                    processStats[i].connectionCount.store(0, std::memory_order_relaxed);
+
+                    if (!isRunning.load())
+                        break;
+
+                    if (WIFSIGNALED(status))
+                        std::cerr << "Worker process " << pid << " was killed by signal " << WTERMSIG(status) << ", restarting it\n";
+                    else
+                        std::cerr << "Worker process " << pid << " exited with code " << WEXITSTATUS(status) << ", restarting it\n";
+
+                    processStats[i].restartCount.fetch_add(1, std::memory_order_relaxed);
+
+                    // A process that dies right after it started would otherwise be restarted in a tight loop
+                    if (now - startTimes[i] < 1000)
+                        restartTimes[i] = now + 1000;
+                }
             }
+
+            events.clear();
+            poller->wait(events, 250);
+
+            // The children keep their copies of the listener until they drain, so nothing is refused meanwhile
+            if (handoff.get_file_descriptor() != INVALID_SOCKET_HANDLE && contains_event(events, handoff.get_file_descriptor()))
+                hand_off({});
+        }
+
+        handoff.close(true);
+
+		if(onClose)
+			onClose();
+
+        for (pid_t child : children)
+        {
+            if (child > 0)
+                kill(child, SIGTERM);
+        }
+
+        for (pid_t child : children)
+        {
+            if (child > 0)
+                waitpid(child, nullptr, 0);
         }
 
-        worker->contexts.clear();
+        listener.close();
+        return 0;
+    #endif
     }
 
-    void http_server::on_read(http_worker_context *worker, int32_t fd)
+    // Copies the counters of the workers into the slot of this process
+    void http_server::publish_stats(const std::vector<std::unique_ptr<http_worker_context>> &workers)
     {
-        auto it = worker->contexts.find(fd);
-        
-        if (it == worker->contexts.end()) 
-            return;
+        uint64_t connectionCount = 0;
+        uint64_t requestCount = 0;
 
-        std::shared_ptr<http_context> context = it->second;
+        for (const auto &worker : workers)
+        {
+            connectionCount += worker->connectionCount.load(std::memory_order_relaxed);
+            requestCount += worker->servedRequests.load(std::memory_order_relaxed);
+        }
 
-        char tempBuffer[8192];
+        http_process_stats &stats = processStats[processIndex];
+        stats.connectionCount.store(connectionCount, std::memory_order_relaxed);
+        stats.requestCount.store(requestBase + requestCount, std::memory_order_relaxed);
+    }
 
-        while (true) 
+    // Totals over all processes. The counters are published by each accept loop, so they may lag up to a second
+    http_server_stats http_server::get_stats() const
+    {
+        http_server_stats result = {};
+
+        for (size_t i = 0; i < processStatsCount; ++i)
         {
-            int64_t bytesRead = context->connection->read(tempBuffer, sizeof(tempBuffer));
-            
-            if (bytesRead > 0) 
-            {
-				if (context->requestBuffer.size() + bytesRead > config.maxHeaderSize) 
-				{
-					send_response(worker, context, 431);
-					return;
-				}
+            const http_process_stats &stats = processStats[i];
+            result.connectionCount += stats.connectionCount.load(std::memory_order_relaxed);
+            result.requestCount += stats.requestCount.load(std::memory_order_relaxed);
+            result.restartCount += stats.restartCount.load(std::memory_order_relaxed);
 
-                context->requestBuffer.append(tempBuffer, bytesRead);
-                size_t headerEnd = context->requestBuffer.find("\r\n\r\n");
+            if (!isStatsShared || stats.processId.load(std::memory_order_relaxed) != 0)
+                result.processCount++;
+        }
 
-                if (headerEnd != std::string::npos)
-                {
-                    if(!http_request::parse(context->requestBuffer, context->request))
-					{
-						send_response(worker, context, 400);
-						return;
-					}
+        return result;
+    }
 
-					context->request.ip = context->connection->get_ip();
+    bool http_server::allocate_stats(size_t count, bool shared)
+    {
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared counters must not need a lock");
 
-                    // Determine where the body starts
-                    size_t headerTotalSize = headerEnd + 4;
-                    size_t leftOverSize = context->requestBuffer.size() - headerTotalSize;
+        free_stats();
+        void *memory = nullptr;
 
-                    std::shared_ptr<http_stream> networkStream;
-                    
-                    if(leftOverSize > 0)
-                    {
-                        std::string initialContent = context->requestBuffer.substr(headerTotalSize);
-                        networkStream = std::make_shared<http_stream>(context->connection, initialContent.data(), initialContent.size());
-                    }
-                    else
-                    {
-                        networkStream = std::make_shared<http_stream>(context->connection, nullptr, 0);
-                    }
+        if (shared)
+        {
+        #if !defined(_WIN32)
+            // Anonymous shared memory stays shared with every child forked afterwards
+            memory = mmap(nullptr, sizeof(http_process_stats) * count, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+            if (memory == MAP_FAILED)
+                return false;
+        #else
+            return false;
+        #endif
+        }
+        else
+        {
+            memory = ::operator new(sizeof(http_process_stats) * count, std::align_val_t(alignof(http_process_stats)));
+        }
 
-                    worker->poller->remove(context->connection->get_file_descriptor());
-
-					context->isLocked.store(true);
-
-					constexpr auto toKiloBytes = [](uint32_t bytes) constexpr {
-						return bytes * 1024;
-					};
-
-					constexpr uint32_t MAX_CONTENT_SIZE = toKiloBytes(128);
-
-					if(context->request.contentLength > MAX_CONTENT_SIZE)
-					{
-						if(threadPool->is_available())
-						{
-							threadPool->enqueue([this, worker, context, networkStream]() {
-								process_request(worker, context, networkStream);
-							});
-						}
-						else
-						{
-							send_response(worker, context, 503);
-						}
-					}
-					else
-					{
-						process_request(worker, context, networkStream);
-					}
+        processStats = static_cast<http_process_stats*>(memory);
+        processStatsCount = count;
+        isStatsShared = shared;
 
-                    return;
-                }
-            }
-            else
-            {
-                if(bytesRead == -1)
-                {
-                    // Socket drained. Level-triggered epoll will wake us up later.
-                    if (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK) 
-                        return;
-					worker->remove(context, "failed to read more request header data from socket");
-					return;
-                }
-                else
-                {
-					//Commented out because this disconnects connections that are keep-alive
-					//Since we regularly check for 'zombie' connections they don't stick around for too long
-                    //worker->remove(context.get(), "failed to read request header data from socket");
-                    return;
-                }
-            }
+        for (size_t i = 0; i < count; ++i)
+        {
+            http_process_stats *stats = new (&processStats[i]) http_process_stats;
+            stats->connectionCount.store(0);
+            stats->requestCount.store(0);
+            stats->restartCount.store(0);
+            stats->processId.store(0);
         }
+
+        return true;
     }
 
-	void http_server::process_request(http_worker_context *worker, std::shared_ptr<http_context> context, std::shared_ptr<http_stream> networkStream)
-	{
-		context->connection->set_blocking(true);
+    void http_server::free_stats()
+    {
+        if (!processStats)
+            return;
 
-		try 
-		{
-			http_response response = onRequest(context->request, networkStream.get());
-			context->response = std::move(response);
-		} 
-		catch (const std::exception& e) 
-		{
-			context->connection->set_blocking(false);
-			send_response(worker, context, 500);
-			return;
-		}
+    #if !defined(_WIN32)
+        if (isStatsShared)
+            munmap(processStats, sizeof(http_process_stats) * processStatsCount);
+        else
+    #endif
+            ::operator delete(processStats, std::align_val_t(alignof(http_process_stats)));
 
-		context->responseBuffer.reserve(1024);
-		stw::stringstream responseStream(context->responseBuffer);
+        processStats = nullptr;
+        processStatsCount = 0;
+    }
 
-		responseStream << "HTTP/1.1 " << context->response.statusCode << "\r\n";
+    void http_server::worker_update(http_worker_context *worker)
+    {
+        std::vector<stw::poll_event_result> activeEvents;
+        activeEvents.reserve(1024);
+        std::vector<stw::poll_event_result> readyEvents;
+        std::vector<stw::timer_node*> expiredTimers;
+        std::vector<http_completion_entry> completedResponses;
+        std::vector<std::coroutine_handle<>> resumptions;
 
-		if(context->response.content)
-			responseStream << "Content-Length: " << context->response.content->get_length() << "\r\n";
-		else
-			responseStream << "Content-Length: 0\r\n";
+        gCurrentWorker = worker;
 
-		bool keepAlive = true;
-		bool mustClose = false;
+        // Pinned before anything below is allocated, so the buffers of its connections end up on the local NUMA node
+        if (!worker->cpus.empty() && !stw::runtime::set_thread_affinity(worker->cpus))
+            std::cerr << "Failed to pin worker to CPU " << worker->cpus[0] << '\n';
 
-		if(context->request.headers.contains("connection"))
-		{
-			if(stw::string::compare(context->request.headers["connection"], "close", true))
-				keepAlive = false;
+        while (!worker->stopFlag.load())
+        {
+			if(activeEvents.size() > 0)
+				activeEvents.clear();
+
+			int64_t drainDeadline = worker->drainDeadline.load(std::memory_order_relaxed);
+
+			if (drainDeadline != 0)
+			{
+				if (!worker->isDraining.load(std::memory_order_acquire))
+					worker->begin_drain();
+
+				// Connections that are still around at the deadline are closed below
+				bool isDrained = worker->connectionCount.load(std::memory_order_relaxed) == 0 && worker->queuedCount.load(std::memory_order_relaxed) == 0;
+
+				if (isDrained || worker->now >= drainDeadline)
+					break;
+			}
+
+			// Sleep no longer than until the first timer is due
+			int32_t timeout = 0;
+
+			if (worker->pendingEvents.empty())
+				timeout = worker->sleepTimers.get_timeout(worker->now, worker->timers.get_timeout(worker->now, 1000));
+
+			if (drainDeadline != 0 && timeout > drainDeadline - worker->now)
+				timeout = static_cast<int32_t>(drainDeadline - worker->now);
+
+			worker->busySince.store(0, std::memory_order_relaxed);
+
+			int32_t eventCount = worker->poller->wait(activeEvents, timeout);
+
+			worker->now = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
+			worker->busySince.store(worker->now, std::memory_order_relaxed);
+
+			if(worker->completions->hasEntries.load(std::memory_order_acquire))
+			{
+				worker->completions->take(completedResponses, resumptions);
+
+				for (http_completion_entry &entry : completedResponses)
+					on_complete(worker, entry);
+
+				for (std::coroutine_handle<> handle : resumptions)
+					handle.resume();
+
+				completedResponses.clear();
+				resumptions.clear();
+			}
+
+			if(worker->sleepTimers.advance(worker->now, expiredTimers) > 0)
+			{
+				for (stw::timer_node *timer : expiredTimers)
+					std::coroutine_handle<>::from_address(timer->userData).resume();
+
+				expiredTimers.clear();
+			}
+
+			if(worker->timers.advance(worker->now, expiredTimers) > 0)
+			{
+				for (stw::timer_node *timer : expiredTimers)
+					on_timeout(worker, static_cast<http_context*>(timer->userData));
+
+				expiredTimers.clear();
+			}
+
+			http_queued_connection newConnection;
+
+            while (worker->queue.try_dequeue(newConnection))
+            {
+                worker->queuedCount.fetch_sub(1, std::memory_order_relaxed);
+                worker->add(stw::socket(newConnection.handle), newConnection.requestCount, newConnection.idleDeadline);
+            }
+
+			if (!worker->siblings.empty() && worker->now - worker->lastRebalance >= 1000)
+			{
+				worker->lastRebalance = worker->now;
+				worker->rebalance();
+			}
+
+			// Swap so contexts that become ready again while processing wait for the next iteration
+			readyEvents.swap(worker->pendingEvents);
+
+			for (const auto &ev : readyEvents)
+				on_event(worker, ev);
+
+			readyEvents.clear();
+
+			if(eventCount == 0)
+				continue;
+
+            for (const auto &ev : activeEvents)
+            {
+                if (ev.fd == worker->listener.get_file_descriptor())
+                {
+                    on_accept(worker);
+                    continue;
+                }
+
+                on_event(worker, ev);
+            }
+        }
+
+        worker->pendingEvents.clear();
+
+        // Handles that complete from now on have nobody left to deliver to
+        worker->completions->close();
+
+        for (http_context *context : worker->contexts)
+        {
+            if (context)
+                worker->remove(context, "server shutting down");
+        }
+
+        gCurrentWorker = nullptr;
+    }
+
+    void http_server::on_event(http_worker_context *worker, const stw::poll_event_result &ev)
+    {
+        // Events carry the generation of the context they were registered for, anything else is stale
+        http_context *context = worker->find(ev.fd, ev.token);
+
+        if (!context)
+            return;
+
+        if (ev.flags & stw::poll_event_error || ev.flags & stw::poll_event_disconnect)
+        {
+            if(context->isLocked.load())
+                return;
+
+            worker->remove(context, "disconnected by client");
+            return;
+        }
+
+        if (worker->edgeTriggered)
+        {
+            // Interest stays registered, readiness is remembered and the context state decides what comes next
+            if (ev.flags & stw::poll_event_read)
+                context->canRead = true;
+
+            if (!context->isLocked.load())
+                on_ready(worker, context);
+            return;
+        }
+
+        if (ev.flags & stw::poll_event_read)
+        {
+            if(context->isLocked.load())
+                return;
+
+            on_read(worker, context);
+
+            // Reading may have closed the connection
+            context = worker->find(ev.fd, ev.token);
+
+            if (!context)
+                return;
+        }
+
+        if (ev.flags & stw::poll_event_write)
+        {
+            if(context->isLocked.load())
+                return;
+
+            on_write(worker, context);
+        }
+    }
+
+    void http_server::on_ready(http_worker_context *worker, http_context *context)
+    {
+        if (context->isWriting)
+            on_write(worker, context);
+        else if (context->canRead)
+            on_read(worker, context);
+    }
+
+    void http_server::on_accept(http_worker_context *worker)
+    {
+        std::vector<stw::socket> clients;
+        constexpr size_t MAX_ACCEPT_BATCH = 64;
+        clients.reserve(MAX_ACCEPT_BATCH);
+
+        // The listener is non-blocking, so keep accepting until the backlog is drained
+        while (true)
+        {
+            try
+            {
+                clients.clear();
+                size_t count = worker->listener.accept_batch(clients, MAX_ACCEPT_BATCH);
+
+                for (size_t i = 0; i < count; ++i)
+                    worker->add(std::move(clients[i]));
+
+                if (count < MAX_ACCEPT_BATCH)
+                    return;
+            }
+            catch(const std::bad_alloc &e)
+            {
+                std::cerr << "Failed to allocate memory for new client " << e.what() << "\n";
+                return;
+            }
+        }
+    }
+
+    void http_server::on_read(http_worker_context *worker, http_context *context)
+    {
+        if (context->phase == http_context_phase_receive)
+        {
+            if (context->pendingRead)
+                on_body_ready(worker, context, false);
+            else
+                on_body(worker, context);
+            return;
+        }
+
+        char tempBuffer[8192];
+
+        while (true) 
+        {
+            int64_t bytesRead = context->connection.read(tempBuffer, sizeof(tempBuffer));
+            
+            if (bytesRead > 0) 
+            {
+				if (context->requestBuffer.size() - context->requestOffset + bytesRead > config.maxHeaderSize) 
+				{
+					send_response(worker, context, 431);
+					return;
+				}
+
+                context->requestBuffer.append(tempBuffer, bytesRead);
+
+                if (on_request(worker, context))
+                    return;
+            }
+            else
+            {
+                if(bytesRead == -1)
+                {
+                    // Socket drained. The poller will wake us up when more data arrives.
+                    if (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK) 
+                    {
+                        context->canRead = false;
+                        return;
+                    }
+					worker->remove(context, "failed to read more request header data from socket");
+					return;
+                }
+                else
+                {
+                    // The peer shut down its side. Keeping the connection would make a level-triggered
+                    // poller report it as readable over and over, and an edge-triggered one never again
+                    worker->remove(context, "connection closed by client");
+                    return;
+                }
+            }
+        }
+    }
+
+    // Handles the requests that are complete in the request buffer. Pipelined requests are handled one after the other
+    // and their responses sent together. Returns false when no request is complete yet and more data has to be read.
+    bool http_server::on_request(http_worker_context *worker, http_context *context)
+    {
+        bool isDetached = false;
+
+        while (true)
+        {
+            const char *data = context->requestBuffer.data() + context->requestOffset;
+            size_t size = context->requestBuffer.size() - context->requestOffset;
+
+            if (size == 0)
+                return false;
+
+            // The header deadline is not extended by later reads, so a client can't keep it open by sending a byte at a time
+            if (context->phase == http_context_phase_idle)
+            {
+                context->phase = http_context_phase_header;
+                worker->set_timeout(context, config.headerTimeout * 1000);
+            }
+
+            http_scan_result scanResult = context->scanner.scan(data, size);
+
+            if (scanResult == http_scan_result_incomplete)
+                return false;
+
+            if (scanResult == http_scan_result_error || !http_request::parse(data, context->scanner.headerEnd, context->request))
+            {
+                send_response(worker, context, 400);
+                return true;
+            }
+
+            context->request.ip = context->connection.get_ip();
+
+            // Only the part of the buffer that belongs to the body is given to the stream, anything after it is the next request
+            size_t headerSize = context->scanner.headerEnd;
+            uint64_t bodySize = context->request.contentLength;
+
+            // The parser turns away requests that also carry Content-Length, a chunked body ends where decoding says so
+            const std::string *transferEncoding = context->request.headers.get(http_header_id_transfer_encoding);
+
+            if (transferEncoding)
+            {
+                if (!stw::string::compare(*transferEncoding, "chunked", true))
+                {
+                    send_response(worker, context, 501);
+                    return true;
+                }
+
+                context->request.contentLength = 0;
+                bodySize = http_stream::UNKNOWN_LENGTH;
+            }
+            else if (config.maxBodySize > 0 && bodySize > config.maxBodySize)
+            {
+                send_response(worker, context, 413);
+                return true;
+            }
+
+            uint64_t bodyInBuffer = std::min<uint64_t>(size - headerSize, bodySize);
+
+            // The request buffer is left alone until the response is sent, so the stream can read from it directly
+            context->stream.reset(&context->connection, data + headerSize, bodyInBuffer, bodySize);
+            context->requestOffset += headerSize + bodyInBuffer;
+
+            if (transferEncoding)
+                context->stream.set_chunked(config.maxBodySize);
+
+            if (!worker->edgeTriggered && !isDetached)
+                worker->poller->remove(context->connection.get_file_descriptor());
+
+            isDetached = true;
+
+            bool isConsumed = false;
+
+            if (bodySize > 0 && onRequestBody)
+            {
+                try
+                {
+                    isConsumed = onRequestBody(context->request, context->consumer);
+                }
+                catch (const std::exception &e)
+                {
+                    // The body is left unread, the connection can't be reused after the error response
+                    context->consumer = http_body_consumer();
+                    worker->timers.cancel(&context->timer);
+                    set_error_response(context, 500);
+                    finalize_request(worker, context);
+                    return true;
+                }
+            }
+
+            // A body handed to a consumer is received by the worker itself, no thread has to wait for it
+            if (isConsumed)
+            {
+                context->phase = http_context_phase_receive;
+                worker->set_timeout(context, config.bodyTimeout * 1000);
+
+                if (!worker->edgeTriggered)
+                    worker->poller->add(context->connection.get_file_descriptor(), stw::poll_event_read, context->generation);
+
+                on_body(worker, context);
+                return true;
+            }
+
+            // Handlers may take as long as they need, body reads are bounded by the socket receive timeout instead
+            worker->timers.cancel(&context->timer);
+            context->phase = http_context_phase_body;
+            context->isLocked.store(true);
+
+            constexpr auto toKiloBytes = [](uint32_t bytes) constexpr {
+                return bytes * 1024;
+            };
+
+            constexpr uint32_t MAX_CONTENT_SIZE = toKiloBytes(128);
+
+            // A chunked body has no size up front, it may take as long to arrive as a large one
+            bool isLargeBody = context->request.contentLength > MAX_CONTENT_SIZE || bodySize == http_stream::UNKNOWN_LENGTH;
+
+            // Coroutine handlers wait for the body without blocking, they stay on the worker
+            if(isLargeBody && !onRequestTask)
+            {
+                // The task holds its own reference, the context is not recycled even if the worker drops it
+                context->retain();
+
+                bool isQueued = threadPool->enqueue([this, worker, context]() {
+                    if (process_request(worker, context))
+                        finalize_request(worker, context);
+                    context->release();
+                });
+
+                // The pool is saturated, turning the request away now beats letting the backlog grow
+                if (!isQueued)
+                {
+                    context->release();
+                    send_response(worker, context, 503);
+                }
+
+                return true;
+            }
+
+            // An asynchronous handler finishes the request later, later pipelined requests wait for it
+            if (!process_request(worker, context))
+                return true;
+
+            if (!batch_response(worker, context))
+            {
+                finalize_request(worker, context);
+                return true;
+            }
+
+            context->phase = http_context_phase_idle;
+        }
+    }
+
+	// Runs the handler. Returns false when an asynchronous handler has not completed the request yet,
+	// on_complete then prepares the response once it has
+	bool http_server::process_request(http_worker_context *worker, http_context *context)
+	{
+		// Handlers other than coroutines read the body with blocking reads, without a receive timeout a stalled client
+		// would hold the thread forever. A body that is already in the buffer never touches the socket
+		bool isBlocking = !onRequestTask && context->stream.get_unread_socket_bytes() > 0;
+
+		if (isBlocking)
+		{
+			context->connection.set_timeout(config.bodyTimeout);
+			context->connection.set_blocking(true);
+		}
+
+		if (onRequestTask || onRequestAsync)
+		{
+			// The handle holds a reference, so the context is not recycled before the response arrives
+			auto state = std::make_shared<http_completion_state>();
+			state->queue = worker->completions;
+			state->context = context;
+			state->fd = context->connection.get_file_descriptor();
+			state->generation = context->generation;
+			state->isCompleted.store(false);
+			context->retain();
+
+			try 
+			{
+				if (onRequestTask)
+				{
+					// The coroutine waits for body data through read_async, the socket stays non-blocking
+					run_task(onRequestTask(context->request, &context->stream), http_completion(state));
+				}
+				else
+				{
+					onRequestAsync(context->request, &context->stream, http_completion(state));
+				}
+			} 
+			catch (const std::exception& e) 
+			{
+				if (isBlocking)
+					context->connection.set_blocking(false);
+
+				// A response that was completed before the exception is already on its way
+				if (state->isCompleted.exchange(true))
+					return false;
+
+				context->release();
+				set_error_response(context, 500);
+				return true;
+			}
+
+			if (isBlocking)
+				context->connection.set_blocking(false);
+			return false;
+		}
+
+		try 
+		{
+			http_response response = onRequest(context->request, &context->stream);
+			context->response = std::move(response);
+		} 
+		catch (const std::exception& e) 
+		{
+			if (isBlocking)
+				context->connection.set_blocking(false);
+			set_error_response(context, 500);
+			return true;
+		}
+
+		if (isBlocking)
+			context->connection.set_blocking(false);
+		prepare_response(worker, context);
+		return true;
+	}
+
+	void http_server::on_complete(http_worker_context *worker, http_completion_entry &entry)
+	{
+		http_context *context = entry.context;
+
+		// The connection is only gone when the server shuts down, the context must not be answered then
+		if (worker->find(entry.fd, entry.generation) == context)
+		{
+			if (entry.isFailed)
+			{
+				set_error_response(context, 500);
+			}
+			else
+			{
+				context->response = std::move(entry.response);
+				prepare_response(worker, context);
+			}
+
+			finalize_request(worker, context);
+		}
+
+		context->release();
+	}
+
+	// Appends the header of context->response to the response buffer
+	void http_server::prepare_response(http_worker_context *worker, http_context *context)
+	{
+		// The handler only saw a failed read, whatever it answered the client sent a body that can't be used
+		if (context->stream.is_invalid())
+		{
+			set_error_response(context, context->stream.is_too_large() ? 413 : 400);
+			return;
+		}
+
+		context->responseBuffer.reserve(1024);
+		stw::stringstream responseStream(context->responseBuffer);
+
+		responseStream << "HTTP/1.1 " << context->response.statusCode << "\r\n";
+
+		// Content without a known length is chunked, HTTP/1.0 doesn't know chunks so there the end is marked by closing
+		bool hasUnknownLength = context->response.content && context->response.content->get_length() < 0;
+
+		if(hasUnknownLength)
+		{
+			if(context->request.httpVersion != "HTTP/1.0")
+			{
+				responseStream << "Transfer-Encoding: chunked\r\n";
+				context->isChunked = true;
+			}
+		}
+		else if(context->response.content)
+		{
+			responseStream << "Content-Length: " << context->response.content->get_length() << "\r\n";
+		}
+		else
+		{
+			responseStream << "Content-Length: 0\r\n";
+		}
+
+		bool keepAlive = true;
+		bool mustClose = false;
+
+		if(const std::string *connection = context->request.headers.get(http_header_id_connection))
+		{
+			if(stw::string::compare(*connection, "close", true))
+				keepAlive = false;
 		}
 		else
 		{
@@ -374,7 +1241,7 @@ namespace stw
 		// All fine and dandy, but response headers with a Connection header have precedence over the request Connection header
 		if(context->response.headers.size() > 0)
 		{
-			if(context->response.headers.contains("Connection"))
+			if(context->response.headers.contains(http_header_id_connection))
 			{
 				//The exception is HTTP/1.0
 				if(mustClose)
@@ -390,18 +1257,21 @@ namespace stw
 			}
 		}
 
-		if(context->requestCount == worker->maxRequests)
+		if(context->requestCount == worker->maxRequests || worker->is_stopping())
+			keepAlive = false;
+
+		if(hasUnknownLength && !context->isChunked)
 			keepAlive = false;
 
 		if(context->response.headers.size() > 0)
 		{
+			// The client has to know the connection ends here, whatever the handler put in the headers
+			if(!keepAlive)
+				context->response.headers["Connection"] = "close";
+
+			// Duplicates are written as they are, so multiple Set-Cookie headers each end up on their own line
 			for(const auto& [key,value] : context->response.headers)
-			{
-				// Only write Set-Cookie headers by iterating the cookies vector
-				if(stw::string::compare(key, "Set-Cookie", true))
-					continue;
-				responseStream << key + ": " << value << "\r\n";
-			}
+				responseStream << key << ": " << value << "\r\n";
 		}
 		else
 		{
@@ -429,83 +1299,480 @@ namespace stw
 
 		context->closeConnection = !keepAlive;
 
-		context->connection->set_blocking(false);
-		
+		// Without reading the rest of the body there is no telling where the next request starts
+		if(context->stream.get_unread_socket_bytes() > 0)
+			context->closeConnection = true;
+		else
+		{
+			// Reading a chunked body may go past its end, what was read there is the start of the next request
+			context->requestOffset -= context->stream.get_surplus_bytes();
+			context->requestBuffer.append(context->stream.get_socket_surplus());
+		}
+	}
+
+	// Passes the body to the consumer for as long as the socket has data
+	void http_server::on_body(http_worker_context *worker, http_context *context)
+	{
+		char tempBuffer[8192];
+		bool hasProgress = false;
+
+		while (true)
+		{
+			int64_t bytesRead = context->stream.read(tempBuffer, sizeof(tempBuffer));
+
+			if (bytesRead > 0)
+			{
+				hasProgress = true;
+
+				bool keepReceiving = false;
+
+				try
+				{
+					keepReceiving = context->consumer.onData(tempBuffer, static_cast<size_t>(bytesRead));
+				}
+				catch (const std::exception &e)
+				{
+					// A consumer that throws is treated like one that stops receiving
+					keepReceiving = false;
+				}
+
+				if (!keepReceiving)
+				{
+					on_body_complete(worker, context, false);
+					return;
+				}
+
+				continue;
+			}
+
+			if (context->stream.is_complete())
+			{
+				on_body_complete(worker, context, true);
+				return;
+			}
+
+			if (context->stream.is_invalid())
+			{
+				on_body_complete(worker, context, false);
+				return;
+			}
+
+			if (bytesRead == -1 && (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK))
+			{
+				context->canRead = false;
+
+				// The body timeout is the longest wait for more data, not for the whole body
+				if (hasProgress)
+					worker->set_timeout(context, config.bodyTimeout * 1000);
+				return;
+			}
+
+			worker->remove(context, "connection lost while receiving request body");
+			return;
+		}
+	}
+
+	// Resumes a coroutine handler that waits for body data
+	void http_server::on_body_ready(http_worker_context *worker, http_context *context, bool isAborted)
+	{
+		if (!worker->edgeTriggered)
+			worker->poller->remove(context->connection.get_file_descriptor());
+
+		worker->timers.cancel(&context->timer);
+		context->phase = http_context_phase_body;
+		context->isLocked.store(true);
+
+		http_read_awaitable *pendingRead = context->pendingRead;
+		context->pendingRead = nullptr;
+		pendingRead->isAborted = isAborted;
+		pendingRead->handle.resume();
+	}
+
+	void http_server::on_body_complete(http_worker_context *worker, http_context *context, bool complete)
+	{
+		if (!worker->edgeTriggered)
+			worker->poller->remove(context->connection.get_file_descriptor());
+
+		worker->timers.cancel(&context->timer);
+		context->phase = http_context_phase_body;
+		context->isLocked.store(true);
+
+		try
+		{
+			http_response response = context->consumer.onComplete(complete);
+			context->response = std::move(response);
+			prepare_response(worker, context);
+		}
+		catch (const std::exception &e)
+		{
+			set_error_response(context, 500);
+		}
+
+		// Releases whatever the consumer holds on to
+		context->consumer = http_body_consumer();
+
 		finalize_request(worker, context);
 	}
 
-    void http_server::finalize_request(http_worker_context* worker, std::shared_ptr<http_context> context) 
+	bool http_server::batch_response(http_worker_context *worker, http_context *context)
+	{
+		constexpr int64_t MAX_BATCHED_CONTENT = 64 * 1024;
+		constexpr size_t MAX_BATCHED_SIZE = 256 * 1024;
+
+		if(context->closeConnection || context->requestCount + 1 >= worker->maxRequests)
+			return false;
+
+		if(context->responseBuffer.size() > MAX_BATCHED_SIZE)
+			return false;
+
+		// Holding on to a response only makes sense when the next request can be handled right away
+		context->scanner.reset();
+		const char *data = context->requestBuffer.data() + context->requestOffset;
+		size_t size = context->requestBuffer.size() - context->requestOffset;
+
+		if(size == 0 || context->scanner.scan(data, size) != http_scan_result_complete)
+			return false;
+
+		std::shared_ptr<stw::stream> &content = context->response.content;
+
+		if(content)
+		{
+			int64_t length = content->get_length();
+
+			if(length < 0 || length > MAX_BATCHED_CONTENT)
+				return false;
+
+			uint64_t readOffset = content->get_read_offset();
+			size_t offset = context->responseBuffer.size();
+			int64_t totalRead = 0;
+
+			context->responseBuffer.resize(offset + length);
+
+			while(totalRead < length)
+			{
+				int64_t bytesRead = 0;
+
+				// The headers promise the content, the client sees the connection close before it arrives
+				if(!read_content(content.get(), &context->responseBuffer[offset + totalRead], length - totalRead, bytesRead))
+				{
+					context->responseBuffer.resize(offset);
+					content.reset();
+					context->closeConnection = true;
+					return false;
+				}
+
+				if(bytesRead <= 0)
+					break;
+
+				totalRead += bytesRead;
+			}
+
+			// Leave it to on_write to stream the content
+			if(totalRead < length)
+			{
+				context->responseBuffer.resize(offset);
+				content->seek(readOffset, stw::seek_origin_begin);
+				return false;
+			}
+
+			content.reset();
+		}
+
+		context->requestCount++;
+		worker->servedRequests.fetch_add(1, std::memory_order_relaxed);
+		context->end_request();
+		return true;
+	}
+
+    void http_server::finalize_request(http_worker_context* worker, http_context *context) 
     {
+        if (worker->edgeTriggered)
+        {
+            // The socket never left the poller, only the state changes
+            context->isWriting = true;
+            context->isLocked.store(false);
+
+            if (gCurrentWorker == worker)
+                worker->queue_pending(context);
+            else // Re-arming makes epoll report the current readiness, which wakes up the worker
+                worker->poller->modify(context->connection.get_file_descriptor(), worker->get_interest(), context->generation);
+            return;
+        }
+
         // Re-add the socket to the poller. 
-        worker->poller->add(context->connection->get_file_descriptor(), stw::poll_event_write);
+        worker->poller->add(context->connection.get_file_descriptor(), stw::poll_event_write, context->generation);
 		context->isLocked.store(false);
         // Notify the poller so it recognizes the new FD registration immediately
         worker->poller->notify();
     }
 
-	void http_server::send_response(http_worker_context *worker, std::shared_ptr<http_context> context, uint32_t statusCode)
+	void http_server::send_response(http_worker_context *worker, http_context *context, uint32_t statusCode)
 	{
-		worker->poller->remove(context->connection->get_file_descriptor());
+		if(!worker->edgeTriggered)
+			worker->poller->remove(context->connection.get_file_descriptor());
 		
+		set_error_response(context, statusCode);
+		finalize_request(worker, context);
+	}
+
+	void http_server::set_error_response(http_context *context, uint32_t statusCode)
+	{
+		// Appended, responses to earlier pipelined requests that are still waiting to be sent go out first
 		context->response.content = nullptr;
-		context->responseBuffer = 	"HTTP/1.1 " + std::to_string(statusCode) + 
+		context->responseBuffer += 	"HTTP/1.1 " + std::to_string(statusCode) + 
 									"\r\nConnection: close\r\n\r\n";
 		context->closeConnection = true;
+	}
+
+    void http_server::on_write(http_worker_context *worker, http_context *context)
+    {
+        // The deadline starts with the response and moves with every write that gets data out, so only a client that
+        // stops reading runs into it
+        auto on_progress = [worker, context, this]() {
+            worker->set_timeout(context, config.writeTimeout * 1000);
+        };
+
+        if (context->phase != http_context_phase_write)
+        {
+            context->phase = http_context_phase_write;
+            on_progress();
+        }
+
+        std::shared_ptr<stw::stream> &content = context->response.content;
+
+        // Memory content is sent from where it is, file content with sendfile. Only other streams are copied
+        const uint8_t *memory = content ? static_cast<const uint8_t*>(content->get_memory()) : nullptr;
+        int32_t fileDescriptor = (content && !memory) ? content->get_file_descriptor() : -1;
+
+        while (context->headerBytesSent < context->responseBuffer.size()) 
+        {
+            const char* ptr = context->responseBuffer.data() + context->headerBytesSent;
+            size_t remaining = context->responseBuffer.size() - context->headerBytesSent;
+
+            stw::socket_buffer buffers[2] = {{ ptr, remaining }, { nullptr, 0 }};
+            size_t bufferCount = 1;
+            int64_t contentOffset = 0;
+
+            if (memory)
+            {
+                contentOffset = content->get_read_offset();
+
+                if (contentOffset < content->get_length())
+                {
+                    buffers[1] = { memory + contentOffset, static_cast<size_t>(content->get_length() - contentOffset) };
+                    bufferCount = 2;
+                }
+            }
+
+            // Headers and small bodies go out in one call, and the headers wait for a file that follows them
+            int64_t sent = context->connection.write(buffers, bufferCount, fileDescriptor >= 0);
+
+            if (sent > 0) 
+            {
+                on_progress();
+
+                if (static_cast<size_t>(sent) <= remaining)
+                {
+                    context->headerBytesSent += sent;
+                }
+                else
+                {
+                    context->headerBytesSent = context->responseBuffer.size();
+                    content->seek(contentOffset + (sent - static_cast<int64_t>(remaining)), stw::seek_origin_begin);
+                }
+            } 
+            else
+            {
+                if(sent == -1)
+                {
+                    if(STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK)
+                        return;
+                }
+
+                worker->remove(context, "failed to write response header to socket");
+                return;
+            } 
+        }
+
+        // Content of unknown length is produced while the socket is writable. The headers are out by now,
+        // so responseBuffer holds the chunk being sent and a partial chunk is finished by the loop above
+        if (content && content->get_length() < 0)
+        {
+            char tempBuffer[8192];
+
+            while (true)
+            {
+                context->responseBuffer.clear();
+                context->headerBytesSent = 0;
+
+                // Producers may hand out small pieces, those are gathered into larger chunks. Gathering stops at half
+                // the buffer so a producer is never handed a space too small for what it wants to write
+                int64_t bytesRead = 0;
+                bool isFinished = false;
+
+                while (bytesRead < static_cast<int64_t>(sizeof(tempBuffer) / 2))
+                {
+                    int64_t produced = 0;
+
+                    if (!read_content(content.get(), tempBuffer + bytesRead, sizeof(tempBuffer) - bytesRead, produced))
+                    {
+                        worker->remove(context, "response content producer threw an exception");
+                        return;
+                    }
+
+                    if (produced < 0)
+                    {
+                        // The status line is long gone, cutting the connection is the only way to signal the failure
+                        worker->remove(context, "failed to produce response content");
+                        return;
+                    }
+
+                    if (produced == 0)
+                    {
+                        isFinished = true;
+                        break;
+                    }
+
+                    bytesRead += produced;
+                }
+
+                if (context->isChunked && bytesRead > 0)
+                {
+                    char chunkSize[20];
+                    auto result = std::to_chars(chunkSize, chunkSize + sizeof(chunkSize), static_cast<uint64_t>(bytesRead), 16);
+                    context->responseBuffer.append(chunkSize, result.ptr - chunkSize);
+                    context->responseBuffer.append("\r\n", 2);
+                    context->responseBuffer.append(tempBuffer, bytesRead);
+                    context->responseBuffer.append("\r\n", 2);
+                }
+                else
+                {
+                    context->responseBuffer.append(tempBuffer, bytesRead);
+                }
+
+                // The last chunk is in the buffer, once it is sent the request is finished
+                if (isFinished)
+                {
+                    if (context->isChunked)
+                        context->responseBuffer.append("0\r\n\r\n", 5);
+
+                    content.reset();
+                }
+
+                while (context->headerBytesSent < context->responseBuffer.size()) 
+                {
+                    const char* ptr = context->responseBuffer.data() + context->headerBytesSent;
+                    int64_t sent = context->connection.write(ptr, context->responseBuffer.size() - context->headerBytesSent);
+
+                    if (sent > 0) 
+                    {
+                        context->headerBytesSent += sent;
+                        on_progress();
+                        continue;
+                    }
 
-		finalize_request(worker, context);
-	}
+                    if (sent == -1)
+                    {
+                        if (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK)
+                            return;
+                    }
 
-    void http_server::on_write(http_worker_context *worker, int32_t fd)
-    {
-        auto it = worker->contexts.find(fd);
-        
-        if (it == worker->contexts.end()) 
-            return;
+                    worker->remove(context, "failed to write response content to socket");
+                    return;
+                }
 
-        std::shared_ptr<http_context> context = it->second;
+                if (!content)
+                    goto request_finished;
+            }
+        }
 
-        if (!context->responseBuffer.empty())
+        if (memory)
         {
-            while (context->headerBytesSent < context->responseBuffer.size()) 
-            {
-                const char* ptr = context->responseBuffer.data() + context->headerBytesSent;
-                size_t remaining = context->responseBuffer.size() - context->headerBytesSent;
+            int64_t offset = content->get_read_offset();
+            int64_t length = content->get_length();
 
-                int64_t sent = context->connection->write(ptr, remaining);
+            while (offset < length) 
+            {
+                int64_t bytesSent = context->connection.write(memory + offset, static_cast<size_t>(length - offset));
 
-                if (sent > 0) 
+                if (bytesSent > 0)
                 {
-                    context->headerBytesSent += sent;
-                } 
-                else
+                    offset += bytesSent;
+                    on_progress();
+                    continue;
+                }
+
+                if (bytesSent == -1)
                 {
-                    if(sent == -1)
-                    {
-                        if(STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK)
-                            return;
-                    }
-                    else
+                    if (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK) 
                     {
-                        worker->remove(context, "failed to write response header to socket");
+                        content->seek(offset, stw::seek_origin_begin);
                         return;
                     }
-                } 
+                }
+
+                worker->remove(context, "failed to write response content to socket");
+                return;
             }
+
+            goto request_finished;
         }
 
-        if (context->response.content) 
+        if (content) 
         {
+            // File content goes straight from the page cache to the socket
+            if (fileDescriptor >= 0)
+            {
+                int64_t offset = context->response.content->get_read_offset();
+                int64_t length = context->response.content->get_length();
+
+                while (offset < length) 
+                {
+                    int64_t bytesSent = context->connection.send_file(fileDescriptor, offset, length - offset);
+
+                    if (bytesSent > 0)
+                    {
+                        on_progress();
+                        continue;
+                    }
+
+                    if (bytesSent == -1)
+                    {
+                        if (STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK) 
+                        {
+                            // The offset is kept in the stream so the next call resumes where this one stopped
+                            context->response.content->seek(offset, stw::seek_origin_begin);
+                            return;
+                        }
+                    }
+
+                    // A return of 0 means the file was truncated while it was being sent
+                    worker->remove(context, "failed to send response file to socket");
+                    return;
+                }
+
+                goto request_finished;
+            }
+
             char tempBuffer[8192];
             
             while (true) 
             {
                 uint64_t readOffset = context->response.content->get_read_offset();
 
-                int64_t bytesRead = context->response.content->read(tempBuffer, sizeof(tempBuffer));
+                int64_t bytesRead = 0;
+
+                // Without the rest of the content the response can only be cut off
+                if (!read_content(context->response.content.get(), tempBuffer, sizeof(tempBuffer), bytesRead))
+                {
+                    worker->remove(context, "response content stream threw an exception");
+                    return;
+                }
+
                 if (bytesRead <= 0) 
                     goto request_finished; // EOF
 
-                int64_t bytesSent = context->connection->write(tempBuffer, bytesRead);
+                int64_t bytesSent = context->connection.write(tempBuffer, bytesRead);
 
                 if (bytesSent <= 0) 
                 {
@@ -522,6 +1789,8 @@ namespace stw
                     return;
                 }
                 
+                on_progress();
+
                 if (bytesSent < bytesRead) 
                 {
                     // PARTIAL WRITE: Rewind to the exact byte where the socket stopped
@@ -533,8 +1802,10 @@ namespace stw
         }
     request_finished:
 		context->requestCount++;
+		worker->servedRequests.fetch_add(1, std::memory_order_relaxed);
 
-		if(context->requestCount >= worker->maxRequests)
+		// The response may have promised keep-alive before the server started draining
+		if(context->requestCount >= worker->maxRequests || worker->is_stopping())
 			context->closeConnection = true;
 
 		if (context->closeConnection) 
@@ -543,66 +1814,624 @@ namespace stw
             return;
         }
 
-		context->requestBuffer.clear();
+		// Only the answered requests are dropped, anything after them is the start of the next one
+		context->requestBuffer.erase(0, context->requestOffset);
+		context->requestOffset = 0;
+		context->scanner.reset();
         context->responseBuffer.clear();
         context->headerBytesSent = 0;
-        context->response.content.reset();
-		context->lastActivity = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
-		context->request.headers.clear();
-		context->response.headers.clear();
+		context->end_request();
+		context->phase = http_context_phase_idle;
+		worker->set_timeout(context, worker->keepAliveTime * 1000);
+
+        if (worker->edgeTriggered)
+        {
+            context->isWriting = false;
+
+            // A pipelined request may already be waiting in the buffer
+            if (on_request(worker, context))
+                return;
+
+            // No new edge will be reported for data that arrived while the response was being sent
+            if (context->canRead)
+                worker->queue_pending(context);
+            return;
+        }
+
+        if (on_request(worker, context))
+            return;
         
-        worker->poller->modify(context->connection->get_file_descriptor(), stw::poll_event_read);
+        worker->poller->modify(context->connection.get_file_descriptor(), stw::poll_event_read, context->generation);
+    }
+
+    void http_server::on_timeout(http_worker_context *worker, http_context *context)
+    {
+        switch (context->phase)
+        {
+            case http_context_phase_header:
+                // Part of a request arrived, so the client gets told why the connection is closed
+                send_response(worker, context, 408);
+                break;
+            case http_context_phase_receive:
+                // The handler still gets to answer, the connection is closed after it because the body is incomplete
+                if (context->pendingRead)
+                    on_body_ready(worker, context, true);
+                else
+                    on_body_complete(worker, context, false);
+                break;
+            case http_context_phase_write:
+                worker->remove(context, "write timeout");
+                break;
+            default:
+                worker->remove(context, context->requestCount > 0 ? "keep-alive timeout" : "first byte timeout");
+                break;
+        }
     }
 
 	http_context::http_context()
 	{
-		connection = nullptr;
+		pendingRead = nullptr;
+		requestOffset = 0;
 		headerBytesSent = 0;
 		closeConnection = false;
+		isChunked = false;
+		isWriting = false;
+		canRead = false;
 		requestCount = 0;
-		lastActivity = date_time::get_now().get_time_since_epoch_in_milliseconds();
+		generation = 0;
 		isLocked.store(false);
+		refCount.store(0);
+		timer.userData = this;
+		phase = http_context_phase_idle;
 	}
 
-	http_context::http_context(std::shared_ptr<stw::socket> s)
+	// Clears what belonged to the request that was just answered
+	void http_context::end_request()
 	{
-		connection = s;
+		request.headers.clear();
+		request.cookies.clear();
+		response.headers.clear();
+		response.cookies.clear();
+		response.content.reset();
+		stream.reset(nullptr, nullptr, 0);
+		consumer = http_body_consumer();
+		pendingRead = nullptr;
+		isChunked = false;
+	}
+
+	// Returns the context to its initial state, keeping the buffers it has grown unless they got too large
+	void http_context::reset()
+	{
+		constexpr size_t MAX_RETAINED_CAPACITY = 64 * 1024;
+
+		auto clear_buffer = [] (std::string &buffer) {
+			if(buffer.capacity() > MAX_RETAINED_CAPACITY)
+				std::string().swap(buffer);
+			else
+				buffer.clear();
+		};
+
+		connection.close();
+		clear_buffer(requestBuffer);
+		clear_buffer(responseBuffer);
+		scanner.reset();
+
+		request.method = http_method_unknown;
+		request.path.clear();
+		request.httpVersion.clear();
+		request.ip.clear();
+		request.contentLength = 0;
+		request.headers.clear();
+		request.cookies.clear();
+
+		response.statusCode = 0;
+		response.headers.clear();
+		response.cookies.clear();
+		response.content.reset();
+
+		stream.reset(nullptr, nullptr, 0);
+		consumer = http_body_consumer();
+		pendingRead = nullptr;
+		requestOffset = 0;
 		headerBytesSent = 0;
 		closeConnection = false;
+		isChunked = false;
+		isWriting = false;
+		canRead = false;
 		requestCount = 0;
-		lastActivity = date_time::get_now().get_time_since_epoch_in_milliseconds();
+		generation = 0;
+		phase = http_context_phase_idle;
 		isLocked.store(false);
 	}
 
-    http_worker_context::http_worker_context()
+	void http_context::retain()
+	{
+		refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Returns true when this was the last reference
+	bool http_context::release()
+	{
+		return refCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+	}
+
+    http_worker_context::http_worker_context() : queue(1024)
     {
         stopFlag.store(false);
+        drainDeadline.store(0);
+        servedRequests.store(0);
+        connectionCount.store(0);
+        queuedCount.store(0);
+        busySince.store(0);
         poller = stw::poller::create();
-		lastCleanup = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();;
+        completions = std::make_shared<http_completion_queue>(poller.get());
+		now = stw::date_time::get_now().get_time_since_epoch_in_milliseconds();
 		maxRequests = 100;
 		keepAliveTime = 15;
+		firstByteTimeout = 15;
+		bodyTimeout = 30;
+		threadPool = nullptr;
+		nextGeneration = 1;
+		lastRebalance = now;
+		edgeTriggered = false;
+		isDraining.store(false);
     }
 
-	bool http_worker_context::enqueue(std::shared_ptr<stw::socket> s)
+	bool http_worker_context::enqueue(stw::socket &s, uint32_t requestCount, int64_t idleDeadline)
     {
-        if(queue.enqueue(s))
+        stw::socket_t handle = s.release();
+
+        // Counted first, the worker may take it out of the queue right away
+        queuedCount.fetch_add(1, std::memory_order_relaxed);
+
+        if(queue.enqueue({ handle, requestCount, idleDeadline }))
         {
             poller->notify();
 			return true;
         }
+
+        queuedCount.fetch_sub(1, std::memory_order_relaxed);
+
+        // Hand ownership back so the caller can close it
+        s = stw::socket(handle);
         return false;
     }
 
-    void http_worker_context::remove(std::shared_ptr<http_context> context, const char *sender)
+    void http_worker_context::add(stw::socket &&s, uint32_t requestCount, int64_t idleDeadline)
+    {
+        int32_t fd = s.get_file_descriptor();
+
+        if (fd >= (int32_t)contexts.size())
+            contexts.resize(fd + 1024, nullptr);
+
+        http_context *context = acquire();
+        context->connection = std::move(s);
+        context->refCount.store(1);
+        context->generation = nextGeneration++;
+
+        // Generation 0 is never handed out, it is the token of registrations that don't belong to a context
+        if (nextGeneration == 0)
+            nextGeneration = 1;
+
+        contexts[fd] = context;
+        connectionCount.fetch_add(1, std::memory_order_relaxed);
+
+        // A migrated connection is still between requests, it waits out the rest of its keep-alive time
+        context->requestCount = requestCount;
+
+        if (requestCount == 0)
+            set_timeout(context, firstByteTimeout * 1000);
+        else if (idleDeadline != 0)
+            timers.schedule(&context->timer, idleDeadline);
+
+        poller->add(fd, get_interest(), context->generation);
+    }
+
+    http_context *http_worker_context::acquire()
+    {
+        if (freeContexts.empty())
+            reclaim();
+
+        if (freeContexts.empty())
+        {
+            // Contexts are allocated in slabs and never freed while the worker lives
+            constexpr size_t SLAB_SIZE = 64;
+            contextSlabs.push_back(std::make_unique<http_context[]>(SLAB_SIZE));
+            http_context *slab = contextSlabs.back().get();
+
+            for (size_t i = SLAB_SIZE; i > 0; --i)
+                freeContexts.push_back(&slab[i - 1]);
+        }
+
+        http_context *context = freeContexts.back();
+        freeContexts.pop_back();
+        return context;
+    }
+
+    // Moves retired contexts whose last thread pool reference is gone back to the free list
+    void http_worker_context::reclaim()
+    {
+        for (size_t i = 0; i < retiredContexts.size();)
+        {
+            http_context *context = retiredContexts[i];
+
+            if (context->refCount.load(std::memory_order_acquire) > 0)
+            {
+                ++i;
+                continue;
+            }
+
+            context->reset();
+            freeContexts.push_back(context);
+            retiredContexts[i] = retiredContexts.back();
+            retiredContexts.pop_back();
+        }
+    }
+
+    http_completion_queue::http_completion_queue(stw::poller *poller)
+    {
+        this->poller = poller;
+        hasEntries.store(false);
+        isClosed = false;
+    }
+
+    void http_completion_queue::post(http_completion_entry &&entry)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (isClosed)
+            return;
+
+        entries.push_back(std::move(entry));
+        hasEntries.store(true, std::memory_order_release);
+
+        // Done while holding the lock, the worker closes the queue before its poller goes away
+        poller->notify();
+    }
+
+    void http_completion_queue::post(std::coroutine_handle<> handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (isClosed)
+            return;
+
+        resumptions.push_back(handle);
+        hasEntries.store(true, std::memory_order_release);
+        poller->notify();
+    }
+
+    void http_completion_queue::take(std::vector<http_completion_entry> &target, std::vector<std::coroutine_handle<>> &targetResumptions)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        target.swap(entries);
+        targetResumptions.swap(resumptions);
+        hasEntries.store(false, std::memory_order_relaxed);
+    }
+
+    void http_completion_queue::close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isClosed = true;
+        entries.clear();
+        resumptions.clear();
+        hasEntries.store(false, std::memory_order_relaxed);
+    }
+
+    http_completion_state::~http_completion_state()
+    {
+        if (isCompleted.load())
+            return;
+
+        http_completion_entry entry;
+        entry.context = context;
+        entry.fd = fd;
+        entry.generation = generation;
+        entry.isFailed = true;
+        queue->post(std::move(entry));
+    }
+
+    http_completion::http_completion()
+    {
+    }
+
+    http_completion::http_completion(const std::shared_ptr<http_completion_state> &state)
+    {
+        this->state = state;
+    }
+
+    // Hands the response to the worker that owns the connection. Returns false if the request was already completed
+    bool http_completion::complete(http_response &&response)
+    {
+        if (!state || state->isCompleted.exchange(true))
+            return false;
+
+        http_completion_entry entry;
+        entry.context = state->context;
+        entry.fd = state->fd;
+        entry.generation = state->generation;
+        entry.response = std::move(response);
+        entry.isFailed = false;
+        state->queue->post(std::move(entry));
+        return true;
+    }
+
+    bool http_completion::is_completed() const
+    {
+        return !state || state->isCompleted.load();
+    }
+
+    // The worker running on the calling thread, if any
+    http_worker_context *http_worker_context::get_current()
+    {
+        return gCurrentWorker;
+    }
+
+    http_sleep_awaitable sleep_for(uint32_t milliseconds)
+    {
+        http_sleep_awaitable awaitable;
+        awaitable.milliseconds = milliseconds;
+        return awaitable;
+    }
+
+    void http_sleep_awaitable::await_suspend(std::coroutine_handle<> handle)
+    {
+        http_worker_context *worker = http_worker_context::get_current();
+
+        if (!worker)
+            throw std::runtime_error("Coroutines can only be suspended on a worker thread");
+
+        timer.userData = handle.address();
+        worker->sleepTimers.schedule(&timer, worker->now + milliseconds);
+    }
+
+    http_read_awaitable read_async(http_stream *stream, void *buffer, size_t size)
+    {
+        http_read_awaitable awaitable;
+        awaitable.stream = stream;
+        awaitable.buffer = buffer;
+        awaitable.size = size;
+        awaitable.result = 0;
+        awaitable.isAborted = false;
+        return awaitable;
+    }
+
+    bool http_read_awaitable::await_ready()
+    {
+        result = stream->read(buffer, size);
+
+        if (result >= 0 || stream->is_invalid())
+            return true;
+
+        return !(STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK);
+    }
+
+    bool http_read_awaitable::await_suspend(std::coroutine_handle<> handle)
+    {
+        http_worker_context *worker = http_worker_context::get_current();
+
+        if (!worker)
+            throw std::runtime_error("Coroutines can only be suspended on a worker thread");
+
+        int32_t fd = stream->get_socket()->get_file_descriptor();
+        http_context *context = fd >= 0 && static_cast<size_t>(fd) < worker->contexts.size() ? worker->contexts[fd] : nullptr;
+
+        if (!context)
+            return false;
+
+        // The context takes part in the event loop again until data arrives, see http_server::on_body_ready
+        this->handle = handle;
+        context->pendingRead = this;
+        context->phase = http_context_phase_receive;
+        context->canRead = false;
+        worker->set_timeout(context, worker->bodyTimeout * 1000);
+
+        if (!worker->edgeTriggered)
+            worker->poller->add(fd, stw::poll_event_read, context->generation);
+
+        context->isLocked.store(false);
+        return true;
+    }
+
+    int64_t http_read_awaitable::await_resume()
+    {
+        // Only set after a suspension, the first read attempt already has its result
+        if (handle)
+        {
+            if (isAborted)
+                return -1;
+
+            result = stream->read(buffer, size);
+        }
+
+        return result;
+    }
+
+    uint32_t http_worker_context::get_interest() const
+    {
+        // In edge triggered mode a socket is registered once for everything it will ever need
+        if (edgeTriggered)
+            return stw::poll_event_read | stw::poll_event_write | stw::poll_event_edge_triggered;
+        return stw::poll_event_read;
+    }
+
+    http_context *http_worker_context::find(int32_t fd, uint32_t generation) const
+    {
+        if (fd < 0 || fd >= (int32_t)contexts.size())
+            return nullptr;
+
+        http_context *context = contexts[fd];
+
+        if (!context || context->generation != generation)
+            return nullptr;
+
+        return context;
+    }
+
+    void http_worker_context::remove(http_context *context, const char *sender)
     {
-        if(!context.get())
+        if(!context)
             return;
 
-        int32_t fd = context->connection->get_file_descriptor();
+        int32_t fd = context->connection.get_file_descriptor();
+        timers.cancel(&context->timer);
         poller->remove(fd);
-        context->connection->close();
-		context->connection.reset();
+        context->connection.close();
 		context->response.content.reset();
-        contexts.erase(fd);
+        contexts[fd] = nullptr;
+        connectionCount.fetch_sub(1, std::memory_order_relaxed);
+
+        // A coroutine waiting for body data would never hear from this connection again, its read fails instead
+        if (context->pendingRead)
+        {
+            http_read_awaitable *pendingRead = context->pendingRead;
+            context->pendingRead = nullptr;
+            pendingRead->isAborted = true;
+            pendingRead->handle.resume();
+        }
+
+        // A thread pool task may still be using it, in that case it is recycled once the task is done
+        if (context->release())
+        {
+            context->reset();
+            freeContexts.push_back(context);
+        }
+        else
+        {
+            retiredContexts.push_back(context);
+        }
+    }
+
+    // Connections and sockets waiting in the queue, plus a penalty for a worker that is stuck processing events.
+    // Every millisecond it has been busy weighs as much as a connection
+    uint64_t http_worker_context::get_load(int64_t now) const
+    {
+        uint64_t load = connectionCount.load(std::memory_order_relaxed) + queuedCount.load(std::memory_order_relaxed);
+        int64_t since = busySince.load(std::memory_order_relaxed);
+
+        if (since != 0 && now > since)
+            load += static_cast<uint64_t>(now - since);
+
+        return load;
+    }
+
+    // Hands an idle connection to another worker. Its request count and keep-alive deadline go along, everything else
+    // is set up again like for a newly accepted one
+    bool http_worker_context::migrate(http_context *context, http_worker_context *target)
+    {
+        int32_t fd = context->connection.get_file_descriptor();
+        int64_t idleDeadline = context->timer.is_scheduled() ? context->timer.expiry : 0;
+        poller->remove(fd);
+
+        if (!target->enqueue(context->connection, context->requestCount, idleDeadline))
+        {
+            poller->add(fd, get_interest(), context->generation);
+            return false;
+        }
+
+        timers.cancel(&context->timer);
+        contexts[fd] = nullptr;
+        connectionCount.fetch_sub(1, std::memory_order_relaxed);
+        context->release();
+        context->reset();
+        freeContexts.push_back(context);
+        return true;
+    }
+
+    // Moves idle keep-alive connections to the least loaded worker when this one has far more than its share
+    void http_worker_context::rebalance()
+    {
+        constexpr uint64_t MIN_IMBALANCE = 16;
+        constexpr uint64_t MAX_MIGRATIONS = 64;
+
+        http_worker_context *target = nullptr;
+        uint64_t targetLoad = UINT64_MAX;
+
+        for (http_worker_context *sibling : siblings)
+        {
+            uint64_t load = sibling->get_load(now);
+
+            if (load < targetLoad)
+            {
+                target = sibling;
+                targetLoad = load;
+            }
+        }
+
+        uint64_t load = connectionCount.load(std::memory_order_relaxed);
+
+        // Moving a connection costs a few system calls, small differences aren't worth it
+        if (!target || load < targetLoad * 2 + MIN_IMBALANCE)
+            return;
+
+        uint64_t toMove = (load - targetLoad) / 2;
+
+        if (toMove > MAX_MIGRATIONS)
+            toMove = MAX_MIGRATIONS;
+
+        for (size_t fd = 0; fd < contexts.size() && toMove > 0; fd++)
+        {
+            http_context *context = contexts[fd];
+
+            // Only connections between requests with nothing buffered can move, nothing else refers to those
+            if (!context || context->phase != http_context_phase_idle || context->requestCount == 0)
+                continue;
+
+            if (!context->requestBuffer.empty() || context->canRead || context->isLocked.load())
+                continue;
+
+            if (context->refCount.load(std::memory_order_acquire) != 1)
+                continue;
+
+            if (!migrate(context, target))
+                return;
+
+            toMove--;
+        }
+    }
+
+    // A busy worker only starts draining once it gets back to its loop, responses it finishes before that close too
+    bool http_worker_context::is_stopping() const
+    {
+        return isDraining.load(std::memory_order_acquire) || drainDeadline.load(std::memory_order_relaxed) != 0;
+    }
+
+    // Stops accepting and closes keep-alive connections that are waiting for their next request. The others are
+    // closed once their current request is answered, connections that were just accepted still get their first one
+    void http_worker_context::begin_drain()
+    {
+        isDraining.store(true, std::memory_order_release);
+
+        if (listener.get_file_descriptor() != INVALID_SOCKET_HANDLE)
+        {
+            poller->remove(listener.get_file_descriptor());
+            listener.close();
+        }
+
+        for (http_context *context : contexts)
+        {
+            if (!context || context->phase != http_context_phase_idle || context->requestCount == 0)
+                continue;
+
+            if (context->requestBuffer.empty() && !context->canRead)
+                remove(context, "server draining");
+        }
+    }
+
+    void http_worker_context::set_timeout(http_context *context, uint32_t milliseconds)
+    {
+        if (milliseconds == 0)
+            timers.cancel(&context->timer);
+        else
+            timers.schedule(&context->timer, now + milliseconds);
+    }
+
+    void http_worker_context::queue_pending(http_context *context)
+    {
+        stw::poll_event_result ev;
+        ev.fd = context->connection.get_file_descriptor();
+        ev.flags = 0;
+        ev.token = context->generation;
+        pendingEvents.push_back(ev);
     }
 }
\ No newline at end of file
@@ -23,13 +23,15 @@ namespace stw
 {
 	http_stream::http_stream()
 	{
-		socket = nullptr;
-		initialContent = nullptr;
-		initialContentLength = 0;
-		initialContentConsumed = 0;
+		reset(nullptr, nullptr, 0);
 	}
 
-	http_stream::http_stream(std::shared_ptr<stw::socket> socket, void *initialContent, size_t initialContentLength)
+	http_stream::http_stream(stw::socket *socket, const void *initialContent, uint64_t initialContentLength, uint64_t contentLength)
+	{
+		reset(socket, initialContent, initialContentLength, contentLength);
+	}
+
+	void http_stream::reset(stw::socket *socket, const void *initialContent, uint64_t initialContentLength, uint64_t contentLength)
 	{
 		this->socket = socket;
 		
@@ -37,24 +39,37 @@ namespace stw
 		{
 			this->initialContent = nullptr;
 			this->initialContentLength = 0;
-			initialContentConsumed = 0;
 		}
 		else
 		{
-			this->initialContent = std::malloc(initialContentLength);
+			this->initialContent = initialContent;
 			this->initialContentLength = initialContentLength;
+		}
 
-			std::memcpy(this->initialContent, initialContent, initialContentLength);
+		initialContentConsumed = 0;
 
-			initialContentConsumed = 0;
-		}
+		if(contentLength == UNKNOWN_LENGTH)
+			socketBytesRemaining = UNKNOWN_LENGTH;
+		else
+			socketBytesRemaining = contentLength > this->initialContentLength ? contentLength - this->initialContentLength : 0;
+
+		chunkState = http_chunk_state_size;
+		chunkRemaining = 0;
+		hasChunkSize = false;
+		maxBodySize = 0;
+		bodyBytesRead = 0;
+		isChunked = false;
+		isTooLarge = false;
+		socketSurplus.clear();
 	}
 
-	http_stream::~http_stream()
+	// Decodes the body as a sequence of chunks. The initial content may run past the end of the body,
+	// reads stop at the last chunk and get_surplus_bytes tells how much of it was left
+	void http_stream::set_chunked(uint64_t maxBodySize)
 	{
-		if(initialContent)
-			std::free(initialContent);
-		initialContent = nullptr;
+		isChunked = true;
+		this->maxBodySize = maxBodySize;
+		socketBytesRemaining = UNKNOWN_LENGTH;
 	}
 
 	int64_t http_stream::read(void *buffer, size_t size)
@@ -68,21 +83,271 @@ namespace stw
 		if (size == 0) 
 			return 0;
 
-		if(initialContentLength == 0)
-			return socket->read(buffer, size);
+		if (!isChunked)
+			return read_raw(buffer, size);
+
+		while (true)
+		{
+			if (chunkState == http_chunk_state_done)
+				return 0;
+
+			if (chunkState == http_chunk_state_error)
+				return -1;
+
+			bool isInitialContent = initialContentConsumed < initialContentLength;
+
+			// Raw bytes are decoded in place, the data of a chunk never takes more room than the bytes it arrived in
+			int64_t bytesRead = read_raw(buffer, size);
+
+			// The peer closing the connection before the last chunk is an error, not the end of the body
+			if (bytesRead == 0)
+				chunkState = http_chunk_state_error;
+
+			if (bytesRead <= 0)
+				return -1;
+
+			size_t consumed = 0;
+			int64_t decoded = decode_chunked(static_cast<uint8_t*>(buffer), static_cast<size_t>(bytesRead), consumed);
+
+			if (decoded < 0)
+				return -1;
 
+			if (chunkState == http_chunk_state_done && consumed < static_cast<size_t>(bytesRead))
+			{
+				// Whatever follows the body is handed back, the start of the next request must not get lost
+				if (isInitialContent)
+					initialContentConsumed -= static_cast<uint64_t>(bytesRead) - consumed;
+				else
+					socketSurplus.assign(static_cast<const char*>(buffer) + consumed, static_cast<size_t>(bytesRead) - consumed);
+			}
+
+			if (decoded > 0)
+				return decoded;
+		}
+	}
+
+	// Reads from the initial content until it is used up, then from the socket
+	int64_t http_stream::read_raw(void *buffer, size_t size)
+	{
 		if (initialContentConsumed < initialContentLength)
 		{
 			size_t remaining = initialContentLength - initialContentConsumed;
 			size_t toConsume = (size < remaining) ? size : remaining;
 
-			std::memcpy(buffer, (uint8_t*)initialContent + initialContentConsumed, toConsume);
+			std::memcpy(buffer, (const uint8_t*)initialContent + initialContentConsumed, toConsume);
 			initialContentConsumed += toConsume;
 
 			return static_cast<int64_t>(toConsume);
 		}
 
-		return socket->read(buffer, size);
+		// Whatever comes after the body belongs to the next request
+		if (socketBytesRemaining == 0)
+			return 0;
+
+		if (socketBytesRemaining != UNKNOWN_LENGTH && size > socketBytesRemaining)
+			size = static_cast<size_t>(socketBytesRemaining);
+
+		int64_t bytesRead = socket->read(buffer, size);
+
+		if (bytesRead > 0 && socketBytesRemaining != UNKNOWN_LENGTH)
+			socketBytesRemaining -= static_cast<uint64_t>(bytesRead);
+
+		return bytesRead;
+	}
+
+	// Strips the chunk framing from buffer and moves the data to its start. Returns the number of data bytes,
+	// or -1 when the framing is invalid or the body grows past its limit. Stops after the last chunk, consumed
+	// is set to the number of bytes that were processed
+	int64_t http_stream::decode_chunked(uint8_t *buffer, size_t size, size_t &consumed)
+	{
+		auto hex_value = [] (uint8_t c) -> int32_t {
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		};
+
+		size_t decoded = 0;
+		size_t i = 0;
+
+		while (i < size && chunkState != http_chunk_state_done)
+		{
+			uint8_t c = buffer[i];
+
+			switch (chunkState)
+			{
+				case http_chunk_state_size:
+				{
+					int32_t value = hex_value(c);
+
+					if (value >= 0)
+					{
+						// More digits than fit in 60 bits is not a size anyone means
+						if (chunkRemaining >> 60)
+						{
+							chunkState = http_chunk_state_error;
+							return -1;
+						}
+
+						chunkRemaining = (chunkRemaining << 4) | static_cast<uint64_t>(value);
+						hasChunkSize = true;
+					}
+					else if (!hasChunkSize)
+					{
+						// Without digits the line would pass for the last chunk and end the body early
+						chunkState = http_chunk_state_error;
+						return -1;
+					}
+					else if (c == ';' || c == ' ' || c == '\t')
+					{
+						chunkState = http_chunk_state_extension;
+					}
+					else if (c == '\r')
+					{
+						chunkState = http_chunk_state_size_lf;
+					}
+					else
+					{
+						chunkState = http_chunk_state_error;
+						return -1;
+					}
+
+					i++;
+					break;
+				}
+				case http_chunk_state_extension:
+					// Extensions are allowed but nothing here understands them
+					if (c == '\r')
+						chunkState = http_chunk_state_size_lf;
+					i++;
+					break;
+				case http_chunk_state_size_lf:
+					if (c != '\n')
+					{
+						chunkState = http_chunk_state_error;
+						return -1;
+					}
+
+					if (maxBodySize > 0 && chunkRemaining > maxBodySize - bodyBytesRead)
+					{
+						chunkState = http_chunk_state_error;
+						isTooLarge = true;
+						return -1;
+					}
+
+					chunkState = chunkRemaining > 0 ? http_chunk_state_data : http_chunk_state_trailer;
+					i++;
+					break;
+				case http_chunk_state_data:
+				{
+					size_t available = size - i;
+					size_t toCopy = chunkRemaining < available ? static_cast<size_t>(chunkRemaining) : available;
+
+					if (decoded != i)
+						std::memmove(buffer + decoded, buffer + i, toCopy);
+
+					decoded += toCopy;
+					i += toCopy;
+					chunkRemaining -= toCopy;
+					bodyBytesRead += toCopy;
+
+					if (chunkRemaining == 0)
+						chunkState = http_chunk_state_data_cr;
+					break;
+				}
+				case http_chunk_state_data_cr:
+				case http_chunk_state_data_lf:
+				{
+					uint8_t expected = chunkState == http_chunk_state_data_cr ? '\r' : '\n';
+
+					if (c != expected)
+					{
+						chunkState = http_chunk_state_error;
+						return -1;
+					}
+
+					chunkState = chunkState == http_chunk_state_data_cr ? http_chunk_state_data_lf : http_chunk_state_size;
+					hasChunkSize = false;
+					i++;
+					break;
+				}
+				case http_chunk_state_trailer:
+					// Trailer fields are skipped, an empty line ends the body
+					chunkState = c == '\r' ? http_chunk_state_trailer_lf : http_chunk_state_trailer_line;
+					i++;
+					break;
+				case http_chunk_state_trailer_line:
+					if (c == '\n')
+						chunkState = http_chunk_state_trailer;
+					i++;
+					break;
+				case http_chunk_state_trailer_lf:
+					if (c != '\n')
+					{
+						chunkState = http_chunk_state_error;
+						return -1;
+					}
+
+					chunkState = http_chunk_state_done;
+					i++;
+					break;
+				default:
+					return -1;
+			}
+		}
+
+		consumed = i;
+		return static_cast<int64_t>(decoded);
+	}
+
+	uint64_t http_stream::get_unread_socket_bytes() const
+	{
+		// The end of a chunked body is only known once the last chunk has been read
+		if (isChunked)
+			return chunkState == http_chunk_state_done ? 0 : UNKNOWN_LENGTH;
+
+		return socketBytesRemaining;
+	}
+
+	stw::socket *http_stream::get_socket() const
+	{
+		return socket;
+	}
+
+	// True once the whole body was read
+	bool http_stream::is_complete() const
+	{
+		if (isChunked)
+			return chunkState == http_chunk_state_done;
+
+		return socketBytesRemaining == 0 && initialContentConsumed == initialContentLength;
+	}
+
+	// True when the chunk framing was malformed or the body grew past its limit
+	bool http_stream::is_invalid() const
+	{
+		return isChunked && chunkState == http_chunk_state_error;
+	}
+
+	// True when the body was rejected for growing past its limit rather than for its framing
+	bool http_stream::is_too_large() const
+	{
+		return isChunked && isTooLarge;
+	}
+
+	// Bytes of the initial content that come after the body, they belong to the next request
+	uint64_t http_stream::get_surplus_bytes() const
+	{
+		if (isChunked && chunkState == http_chunk_state_done)
+			return initialContentLength - initialContentConsumed;
+
+		return 0;
+	}
+
+	// Bytes read from the socket that come after the body
+	const std::string &http_stream::get_socket_surplus() const
+	{
+		return socketSurplus;
 	}
 
 	bool http_stream::read_as_string(std::string &str, uint64_t size)
@@ -101,12 +366,9 @@ namespace stw
 
             int64_t bytesRead = this->read(buffer, toRead);
 
+            // The socket is blocking while a handler runs, so EAGAIN means the receive timeout expired
             if (bytesRead <= 0)
-            {
-				if(STW_SOCKET_ERR == STW_EAGAIN || STW_SOCKET_ERR == STW_EWOULDBLOCK)
-					continue;
 				return false;
-            }
 
             str.append(buffer, static_cast<size_t>(bytesRead));
             bytesRemaining -= static_cast<uint64_t>(bytesRead);
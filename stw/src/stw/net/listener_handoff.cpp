@@ -0,0 +1,264 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "listener_handoff.hpp"
+#include <cstring>
+
+#if !defined(_WIN32)
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <sys/time.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+#endif
+
+namespace stw
+{
+#if !defined(_WIN32)
+	// More descriptors than this are never passed, a server has one listener per worker at most
+	static constexpr size_t MAX_HANDOFF_DESCRIPTORS = 64;
+
+	static bool make_address(const std::string &path, struct sockaddr_un &address)
+	{
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+
+		if (path.empty() || path.size() >= sizeof(address.sun_path))
+			return false;
+
+		std::memcpy(address.sun_path, path.c_str(), path.size());
+		return true;
+	}
+
+	static void set_timeout(int fd, uint32_t milliseconds)
+	{
+		struct timeval timeout;
+		timeout.tv_sec = milliseconds / 1000;
+		timeout.tv_usec = (milliseconds % 1000) * 1000;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	}
+#endif
+
+	listener_handoff::listener_handoff()
+	{
+		fd = INVALID_SOCKET_HANDLE;
+	}
+
+	listener_handoff::~listener_handoff()
+	{
+		close(false);
+	}
+
+	// Waits for the next process on path. A file left there by a server that is gone is replaced
+	bool listener_handoff::listen(const std::string &path)
+	{
+	#if defined(_WIN32)
+		return false;
+	#else
+		close(false);
+
+		struct sockaddr_un address;
+
+		if (!make_address(path, address))
+			return false;
+
+		fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd == INVALID_SOCKET_HANDLE)
+			return false;
+
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		unlink(path.c_str());
+
+		if (::bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, 4) != 0)
+		{
+			::close(fd);
+			fd = INVALID_SOCKET_HANDLE;
+			return false;
+		}
+
+		this->path = path;
+		return true;
+	#endif
+	}
+
+	// Answers a process that connected to the handoff socket with the given descriptors. They stay open in this
+	// process as well, the caller stops using them once this returns true
+	bool listener_handoff::send(const std::vector<socket_handle> &descriptors)
+	{
+	#if defined(_WIN32)
+		return false;
+	#else
+		if (fd == INVALID_SOCKET_HANDLE || descriptors.size() > MAX_HANDOFF_DESCRIPTORS)
+			return false;
+
+		int connection = ::accept(fd, nullptr, nullptr);
+
+		if (connection < 0)
+			return false;
+
+		// The connection inherits O_NONBLOCK on some platforms, a short timeout is enough for a process that is waiting
+		fcntl(connection, F_SETFL, fcntl(connection, F_GETFL, 0) & ~O_NONBLOCK);
+		set_timeout(connection, 1000);
+
+		char request = 0;
+
+		if (::recv(connection, &request, 1, 0) != 1 || request != 'R')
+		{
+			::close(connection);
+			return false;
+		}
+
+		char reply = 'H';
+		struct iovec data = { &reply, 1 };
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_DESCRIPTORS)];
+
+		if (!descriptors.empty())
+		{
+			std::memset(control, 0, sizeof(control));
+			message.msg_control = control;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * descriptors.size());
+
+			struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int) * descriptors.size());
+
+			int *target = reinterpret_cast<int*>(CMSG_DATA(header));
+
+			for (size_t i = 0; i < descriptors.size(); ++i)
+				target[i] = descriptors[i];
+		}
+
+		bool isSent = ::sendmsg(connection, &message, 0) == 1;
+
+		// Only once the other process confirms, it may have died before it got them
+		char confirmation = 0;
+		isSent = isSent && ::recv(connection, &confirmation, 1, 0) == 1 && confirmation == 'K';
+
+		::close(connection);
+		return isSent;
+	#endif
+	}
+
+	// removePath is false when another process took over the path
+	void listener_handoff::close(bool removePath)
+	{
+	#if !defined(_WIN32)
+		if (fd == INVALID_SOCKET_HANDLE)
+			return;
+
+		::close(fd);
+		fd = INVALID_SOCKET_HANDLE;
+
+		if (removePath)
+			unlink(path.c_str());
+
+		path.clear();
+	#endif
+	}
+
+	socket_handle listener_handoff::get_file_descriptor() const
+	{
+		return fd;
+	}
+
+	// Asks the server on path for its listeners. Returns false when there is no server, the caller binds its own
+	bool listener_handoff::receive(const std::string &path, std::vector<socket_handle> &descriptors)
+	{
+		descriptors.clear();
+
+	#if defined(_WIN32)
+		return false;
+	#else
+		struct sockaddr_un address;
+
+		if (!make_address(path, address))
+			return false;
+
+		int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (connection < 0)
+			return false;
+
+		set_timeout(connection, 5000);
+
+		if (::connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+		{
+			::close(connection);
+			return false;
+		}
+
+		char request = 'R';
+		char reply = 0;
+		struct iovec data = { &reply, 1 };
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_DESCRIPTORS)];
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		if (::send(connection, &request, 1, 0) != 1 || ::recvmsg(connection, &message, 0) != 1 || reply != 'H')
+		{
+			::close(connection);
+			return false;
+		}
+
+		for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+		{
+			if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *source = reinterpret_cast<const int*>(CMSG_DATA(header));
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				fcntl(source[i], F_SETFD, FD_CLOEXEC);
+				descriptors.push_back(source[i]);
+			}
+		}
+
+		char confirmation = 'K';
+		bool isConfirmed = ::send(connection, &confirmation, 1, 0) == 1;
+		::close(connection);
+
+		// Without the confirmation the old server keeps serving, the descriptors would only be duplicates
+		if (!isConfirmed)
+		{
+			for (socket_handle descriptor : descriptors)
+				::close(descriptor);
+
+			descriptors.clear();
+			return false;
+		}
+
+		return true;
+	#endif
+	}
+}
@@ -58,7 +58,7 @@ namespace stw
 
 			// Internal registration of the notifyFD so it can wake up wait()
 			struct epoll_event ev;
-			ev.data.fd = notifyFD;
+			ev.data.u64 = get_user_data(notifyFD, 0);
 			ev.events = EPOLLIN; // Level-triggered is fine for the interruptor
 			epoll_ctl(epollFD, EPOLL_CTL_ADD, notifyFD, &ev);
 		}
@@ -71,24 +71,27 @@ namespace stw
 				close(epollFD);
 		}
 
-		bool add(int fd, poll_event_flag flags) override
+		// epoll_ctl is thread safe by itself, so no locking is needed here
+		bool add(int32_t fd, uint32_t flags, uint32_t token) override
 		{
-			std::lock_guard<std::mutex> lock(mtx);
-			return ctl(EPOLL_CTL_ADD, fd, flags);
+			return ctl(EPOLL_CTL_ADD, fd, flags, token);
 		}
 
-		bool modify(int32_t fd, poll_event_flag flags) override
+		bool modify(int32_t fd, uint32_t flags, uint32_t token) override
 		{
-			std::lock_guard<std::mutex> lock(mtx);
-			return ctl(EPOLL_CTL_MOD, fd, flags);
+			return ctl(EPOLL_CTL_MOD, fd, flags, token);
 		}
 
 		bool remove(int32_t fd) override
 		{
-			std::lock_guard<std::mutex> lock(mtx);
 			return epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, nullptr) == 0;
 		}
 
+		bool supports_edge_triggered() const override
+		{
+			return true;
+		}
+
 		// Trigger the poller to wake up from wait()
 		void notify() override
 		{
@@ -103,7 +106,9 @@ namespace stw
 
 			for (int32_t i = 0; i < nfds; ++i)
 			{
-				if (revents[i].data.fd == notifyFD)
+				int32_t fd = static_cast<int32_t>(revents[i].data.u64 & 0xFFFFFFFF);
+
+				if (fd == notifyFD)
 				{
 					// Drain the eventfd notification
 					uint64_t dummy;
@@ -112,10 +117,12 @@ namespace stw
 				}
 
 				poll_event_result res;
-				res.fd = revents[i].data.fd;
+				res.fd = fd;
 				res.flags = 0;
+				res.token = static_cast<uint32_t>(revents[i].data.u64 >> 32);
 
-				if (revents[i].events & EPOLLIN)
+				// A peer that shut down its side shows up as readable, the next read returns 0
+				if (revents[i].events & (EPOLLIN | EPOLLRDHUP))
 					res.flags |= poll_event_read;
 				if (revents[i].events & EPOLLOUT)
 					res.flags |= poll_event_write;
@@ -133,18 +140,25 @@ namespace stw
 		int32_t epollFD;
 		int32_t notifyFD;
 		std::vector<struct epoll_event> revents;
-		std::mutex mtx;
 
-		bool ctl(int32_t op, int32_t fd, uint32_t flags)
+		// The descriptor and the token both travel in the event data, so no lookup is needed in wait()
+		static uint64_t get_user_data(int32_t fd, uint32_t token)
+		{
+			return (static_cast<uint64_t>(token) << 32) | static_cast<uint32_t>(fd);
+		}
+
+		bool ctl(int32_t op, int32_t fd, uint32_t flags, uint32_t token)
 		{
 			struct epoll_event ev;
-			ev.data.fd = fd;
+			ev.data.u64 = get_user_data(fd, token);
 			ev.events = 0; // Level triggered
 
 			if (flags & poll_event_read)
 				ev.events |= EPOLLIN;
 			if (flags & poll_event_write)
 				ev.events |= EPOLLOUT;
+			if (flags & poll_event_edge_triggered)
+				ev.events |= EPOLLET | EPOLLRDHUP;
 
 			return epoll_ctl(epollFD, op, fd, &ev) == 0;
 		}
@@ -171,16 +185,21 @@ namespace stw
 				close(kqueueFD);
 		}
 
-		bool add(int fd, poll_event_flag flags) override
+		bool add(int32_t fd, uint32_t flags, uint32_t token) override
 		{
 			std::lock_guard<std::mutex> lock(mtx);
-			return ctl(fd, flags, EV_ADD | EV_ENABLE);
+			return ctl(fd, flags, get_action(flags), token);
 		}
 
-		bool modify(int32_t fd, poll_event_flag flags) override
+		bool modify(int32_t fd, uint32_t flags, uint32_t token) override
 		{
 			std::lock_guard<std::mutex> lock(mtx);
-			return ctl(fd, flags, EV_ADD | EV_ENABLE);
+			return ctl(fd, flags, get_action(flags), token);
+		}
+
+		bool supports_edge_triggered() const override
+		{
+			return true;
 		}
 
 		bool remove(int32_t fd) override
@@ -234,7 +253,7 @@ namespace stw
 				}
 				else
 				{
-					poll_event_result res = {fd, 0};
+					poll_event_result res = {fd, 0, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(events[i].udata))};
 					map_flags(events[i], res);
 					fdToIdx[fd] = (int32_t)results.size();
 					results.push_back(res);
@@ -259,6 +278,14 @@ namespace stw
 		std::vector<int32_t> fdToIdx;
 		std::mutex mtx;
 
+		static uint16_t get_action(uint32_t flags)
+		{
+			// EV_CLEAR resets the state after the event is retrieved, which makes the filter edge triggered
+			if (flags & poll_event_edge_triggered)
+				return EV_ADD | EV_ENABLE | EV_CLEAR;
+			return EV_ADD | EV_ENABLE;
+		}
+
 		void map_flags(const struct kevent &ev, poll_event_result &res)
 		{
 			if (ev.filter == EVFILT_READ)
@@ -271,13 +298,14 @@ namespace stw
 				res.flags |= poll_event_disconnect;
 		}
 
-		bool ctl(int32_t fd, uint32_t flags, uint16_t action)
+		bool ctl(int32_t fd, uint32_t flags, uint16_t action, uint32_t token)
 		{
 			struct kevent kev[2];
 			int n = 0;
+			void *udata = reinterpret_cast<void*>(static_cast<uintptr_t>(token));
 
 			if (flags & poll_event_read)
-				EV_SET(&kev[n++], fd, EVFILT_READ, action, 0, 0, nullptr);
+				EV_SET(&kev[n++], fd, EVFILT_READ, action, 0, 0, udata);
 			else
 			{
 				struct kevent del_kev;
@@ -286,7 +314,7 @@ namespace stw
 			}
 
 			if (flags & poll_event_write)
-				EV_SET(&kev[n++], fd, EVFILT_WRITE, action, 0, 0, nullptr);
+				EV_SET(&kev[n++], fd, EVFILT_WRITE, action, 0, 0, udata);
 			else
 			{
 				struct kevent del_kev;
@@ -317,25 +345,27 @@ namespace stw
 				closesocket(notifyRecv);
 		}
 
-		bool add(int32_t fd, poll_event_flag flags) override
+		bool add(int32_t fd, uint32_t flags, uint32_t token) override
 		{
 			std::lock_guard<std::mutex> lock(mtx);
 			WSAPOLLFD pfd = {};
 			pfd.fd = static_cast<SOCKET>(fd);
 			pfd.events = translate_flags_to_win(flags);
 			pollFDs.push_back(pfd);
+			tokens.push_back(token);
 			dirty = true;
 			return true;
 		}
 
-		bool modify(int32_t fd, poll_event_flag flags) override
+		bool modify(int32_t fd, uint32_t flags, uint32_t token) override
 		{
 			std::lock_guard<std::mutex> lock(mtx);
-			for (auto &pfd : pollFDs)
+			for (size_t i = 0; i < pollFDs.size(); ++i)
 			{
-				if (pfd.fd == static_cast<SOCKET>(fd))
+				if (pollFDs[i].fd == static_cast<SOCKET>(fd))
 				{
-					pfd.events = translate_flags_to_win(flags);
+					pollFDs[i].events = translate_flags_to_win(flags);
+					tokens[i] = token;
 					dirty = true;
 					return true;
 				}
@@ -346,13 +376,18 @@ namespace stw
 		bool remove(int32_t fd) override
 		{
 			std::lock_guard<std::mutex> lock(mtx);
-			auto it = std::remove_if(pollFDs.begin(), pollFDs.end(), [fd](const WSAPOLLFD &pfd)
-									 { return pfd.fd == static_cast<SOCKET>(fd); });
-			if (it != pollFDs.end())
+			for (size_t i = 0; i < pollFDs.size(); ++i)
 			{
-				pollFDs.erase(it, pollFDs.end());
-				dirty = true;
-				return true;
+				if (pollFDs[i].fd == static_cast<SOCKET>(fd))
+				{
+					// Order doesn't matter to WSAPoll, so swap with the last entry to keep the vectors parallel
+					pollFDs[i] = pollFDs.back();
+					tokens[i] = tokens.back();
+					pollFDs.pop_back();
+					tokens.pop_back();
+					dirty = true;
+					return true;
+				}
 			}
 			return false;
 		}
@@ -371,6 +406,7 @@ namespace stw
 				if (dirty)
 				{
 					workingSet = pollFDs; // std::vector assignment reuses existing memory
+					workingTokens = tokens;
 					dirty = false;
 				}
 			}
@@ -382,8 +418,10 @@ namespace stw
 
 			if (ret > 0)
 			{
-				for (auto &pfd : workingSet)
+				for (size_t i = 0; i < workingSet.size(); ++i)
 				{
+					const WSAPOLLFD &pfd = workingSet[i];
+
 					if (pfd.revents == 0)
 						continue;
 
@@ -397,6 +435,7 @@ namespace stw
 					poll_event_result res;
 					res.fd = static_cast<int32_t>(pfd.fd);
 					res.flags = 0;
+					res.token = workingTokens[i];
 
 					if (pfd.revents & POLLIN)
 						res.flags |= poll_event_read;
@@ -418,6 +457,8 @@ namespace stw
 		SOCKET notifyRecv = INVALID_SOCKET;
 		std::vector<WSAPOLLFD> pollFDs;
 		std::vector<WSAPOLLFD> workingSet;
+		std::vector<uint32_t> tokens; // Parallel to pollFDs
+		std::vector<uint32_t> workingTokens;
 		bool dirty = true;
 		std::mutex mtx;
 
@@ -450,10 +491,11 @@ namespace stw
 
 			std::lock_guard<std::mutex> lock(mtx);
 			pollFDs.push_back(pfd);
+			tokens.push_back(0);
 			dirty = true; // Ensure the working set picks this up
 		}
 
-		short translate_flags_to_win(poll_event_flag flags)
+		short translate_flags_to_win(uint32_t flags)
 		{
 			short win_flags = 0;
 			if (flags & poll_event_read)
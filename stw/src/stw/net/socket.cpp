@@ -17,6 +17,12 @@
 // SOFTWARE.
 
 #include "socket.hpp"
+#if defined(__linux__)
+	#include <sys/sendfile.h>
+#endif
+#if defined(STW_SOCKET_PLATFORM_UNIX)
+	#include <sys/uio.h>
+#endif
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
@@ -112,6 +118,24 @@ namespace stw
         return ip_version_invalid;
     };
 
+    static bool copy_address(const struct sockaddr_storage &address, socket_t &target)
+    {
+        if(address.ss_family == AF_INET) 
+        {
+            std::memcpy(&target.address.ipv4, &address, sizeof(sockaddr_in_t));
+            target.addressFamily = address_family_af_inet;
+            return true;
+        } 
+        else if(address.ss_family == AF_INET6) 
+        {
+            std::memcpy(&target.address.ipv6, &address, sizeof(sockaddr_in6_t));
+            target.addressFamily = address_family_af_inet6;
+            return true;
+        } 
+
+        return false;
+    }
+
 	class socket_exception : public std::exception 
 	{
 	public:
@@ -215,8 +239,23 @@ namespace stw
         }
     }
 
+	socket::socket(const socket_t &handle, socket_protocol_type protocolType)
+	{
+		this->protocolType = protocolType;
+
+		std::memcpy(&s, &handle, sizeof(socket_t));
+
+	#if defined(STW_SOCKET_PLATFORM_WINDOWS)
+		load_winsock();
+	#endif
+	}
+
 	socket::socket(socket &&other) noexcept
 	{
+	#if defined(STW_SOCKET_PLATFORM_WINDOWS)
+		// The destructor of both sockets unloads winsock, so this one needs to be counted as well
+		load_winsock();
+	#endif
 		std::memcpy(&s, &other.s, sizeof(socket_t));
 		other.s.fd = INVALID_SOCKET_HANDLE;
 		protocolType = other.protocolType;
@@ -226,6 +265,7 @@ namespace stw
 	{
 		if(this != &other)
 		{
+			close();
 			std::memcpy(&s, &other.s, sizeof(socket_t));
 			other.s.fd = INVALID_SOCKET_HANDLE;
 			protocolType = other.protocolType;
@@ -289,7 +329,7 @@ namespace stw
 		return true;
 	}
 
-    bool socket::bind(const std::string &bindAddress, uint16_t port)
+    bool socket::bind(const std::string &bindAddress, uint16_t port, bool reusePort)
     {
         if(s.fd == INVALID_SOCKET_HANDLE) 
         {
@@ -318,6 +358,9 @@ namespace stw
             int reuseFlag = 1;
             set_option(SOL_SOCKET, SO_REUSEADDR, &reuseFlag, sizeof(int));
 
+            if(reusePort && !set_reuse_port())
+                return false;
+
             return ::bind(s.fd, (struct sockaddr*)&address, sizeof(address)) == 0;
         } 
         else if (s.addressFamily == address_family_af_inet6) 
@@ -335,6 +378,9 @@ namespace stw
             int reuse = 1;
             set_option(SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
+            if(reusePort && !set_reuse_port())
+                return false;
+
             return ::bind(s.fd, (struct sockaddr*)&address, sizeof(address)) == 0;
         }
 
@@ -395,19 +441,7 @@ namespace stw
         if(target->s.fd == INVALID_SOCKET_HANDLE)
             return false;
 
-        if(address.ss_family == AF_INET) 
-        {
-            sockaddr_in_t *pAddress = (sockaddr_in_t*)&address;
-            std::memcpy(&target->s.address.ipv4, pAddress, sizeof(sockaddr_in_t));
-            target->s.addressFamily = address_family_af_inet;
-        } 
-        else if(address.ss_family == AF_INET6) 
-        {
-            sockaddr_in6_t *pAddress = (sockaddr_in6_t*)&address;
-            std::memcpy(&target->s.address.ipv6, pAddress, sizeof(sockaddr_in6_t));
-            target->s.addressFamily = address_family_af_inet6;
-        } 
-        else 
+        if(!copy_address(address, target->s))
         {
             target->close();
             return false;
@@ -418,15 +452,57 @@ namespace stw
 		return true;
 	}
 
+	size_t socket::accept_batch(std::vector<socket> &targets, size_t maxCount)
+	{
+        if(s.fd == INVALID_SOCKET_HANDLE) 
+            return 0;
+
+        size_t count = 0;
+
+        // Meant for non-blocking listeners, stops as soon as accept reports EAGAIN/EWOULDBLOCK
+        while(count < maxCount)
+        {
+            struct sockaddr_storage address;
+            std::memset(&address, 0, sizeof(address));
+            stw_socklen_t addressLength = sizeof(sockaddr_storage);
+
+        #if defined(__linux__)
+            // Accepted sockets are non-blocking straight away and inherit TCP_NODELAY from the listener
+            socket_handle fd = ::accept4(s.fd, (struct sockaddr*)&address, &addressLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        #else
+            socket_handle fd = ::accept(s.fd, (struct sockaddr*)&address, &addressLength);
+        #endif
+
+            if(fd == INVALID_SOCKET_HANDLE)
+                break;
+
+            socket client(protocolType);
+            client.s.fd = fd;
+
+            if(!copy_address(address, client.s))
+                continue; // Destructor closes the descriptor
+
+        #if !defined(__linux__)
+            client.set_blocking(false);
+            client.set_no_delay(true);
+        #endif
+
+            targets.push_back(std::move(client));
+            count++;
+        }
+
+        return count;
+	}
+
 	void socket::close()
 	{
 		if(s.fd != INVALID_SOCKET_HANDLE) 
 		{
             auto emptyBuffers = [this] () {
-                std::vector<uint8_t> buffer(1024);
+                uint8_t buffer[1024];
                 while(true) 
                 {
-                    int64_t n = read(buffer.data(), buffer.size());
+                    int64_t n = read(buffer, sizeof(buffer));
                     if(n <= 0)
                         break;
                 }
@@ -446,6 +522,38 @@ namespace stw
         }
 	}
 
+	// Gives up ownership of the handle without closing it
+	socket_t socket::release()
+	{
+		socket_t handle;
+		std::memcpy(&handle, &s, sizeof(socket_t));
+		s.fd = INVALID_SOCKET_HANDLE;
+		return handle;
+	}
+
+	// Takes ownership of a socket that was created elsewhere, such as a listener handed over by another process.
+	// On failure the descriptor is left to the caller
+	bool socket::adopt(socket_handle fd)
+	{
+		struct sockaddr_storage address;
+		std::memset(&address, 0, sizeof(address));
+		stw_socklen_t addressLength = sizeof(sockaddr_storage);
+
+		if(::getsockname(fd, (struct sockaddr*)&address, &addressLength) != 0)
+			return false;
+
+		socket_t handle;
+		std::memset(&handle, 0, sizeof(handle));
+
+		if(!copy_address(address, handle))
+			return false;
+
+		close();
+		handle.fd = fd;
+		s = handle;
+		return true;
+	}
+
 	int64_t socket::read(void *buffer, size_t size)
 	{
 		int64_t n = 0;
@@ -479,6 +587,77 @@ namespace stw
 		return n;
 	}
 
+	// Writes all buffers with a single call. With more set the kernel holds on to a small write
+	// until the data that follows it arrives, so headers and body can share a segment
+	int64_t socket::write(const socket_buffer *buffers, size_t count, bool more)
+	{
+		constexpr size_t MAX_BUFFERS = 16;
+
+		if(count > MAX_BUFFERS)
+			count = MAX_BUFFERS;
+
+		int64_t n = 0;
+	#if defined(STW_SOCKET_PLATFORM_WINDOWS)
+		(void)more;
+		WSABUF wsaBuffers[MAX_BUFFERS];
+		for(size_t i = 0; i < count; i++)
+		{
+			wsaBuffers[i].buf = (char*)buffers[i].data;
+			wsaBuffers[i].len = static_cast<ULONG>(buffers[i].size);
+		}
+		DWORD bytesSent = 0;
+		if(::WSASend(s.fd, wsaBuffers, static_cast<DWORD>(count), &bytesSent, 0, nullptr, nullptr) != 0)
+			return -1;
+		n = static_cast<int64_t>(bytesSent);
+	#elif defined(STW_SOCKET_PLATFORM_UNIX)
+		struct iovec vectors[MAX_BUFFERS];
+		for(size_t i = 0; i < count; i++)
+		{
+			vectors[i].iov_base = const_cast<void*>(buffers[i].data);
+			vectors[i].iov_len = buffers[i].size;
+		}
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = vectors;
+		message.msg_iovlen = count;
+		int flags = 0;
+	#if defined(MSG_MORE)
+		if(more)
+			flags |= MSG_MORE;
+	#else
+		(void)more;
+	#endif
+		n = ::sendmsg(s.fd, &message, flags);
+	#endif
+		return n;
+	}
+
+	// Sends up to size bytes of the file starting at offset, and advances offset by the number of bytes sent
+	int64_t socket::send_file(int32_t fileDescriptor, int64_t &offset, size_t size)
+	{
+		int64_t n = -1;
+	#if defined(__linux__)
+		off_t fileOffset = static_cast<off_t>(offset);
+		n = ::sendfile(s.fd, fileDescriptor, &fileOffset, size);
+		if(n > 0)
+			offset = static_cast<int64_t>(fileOffset);
+	#elif defined(STW_SOCKET_PLATFORM_UNIX)
+		// The BSD variants of sendfile have a different signature, copy through a buffer instead
+		char buffer[8192];
+		ssize_t bytesRead = ::pread(fileDescriptor, buffer, size < sizeof(buffer) ? size : sizeof(buffer), static_cast<off_t>(offset));
+		if(bytesRead <= 0)
+			return bytesRead;
+		n = ::send(s.fd, buffer, bytesRead, 0);
+		if(n > 0)
+			offset += n;
+	#else
+		(void)fileDescriptor;
+		(void)offset;
+		(void)size;
+	#endif
+		return n;
+	}
+
 	bool socket::read_all(void *buffer, size_t size)
 	{
 		uint8_t *ptr = static_cast<uint8_t*>(buffer);
@@ -579,6 +758,17 @@ namespace stw
     #endif
     }
 
+    bool socket::set_reuse_port()
+    {
+    #if defined(SO_REUSEPORT)
+        // Every socket bound with this option gets its own accept queue, the kernel balances connections between them
+        int32_t reuseFlag = 1;
+        return set_option(SOL_SOCKET, SO_REUSEPORT, &reuseFlag, sizeof(int32_t));
+    #else
+        return false;
+    #endif
+    }
+
     bool socket::set_no_delay(bool noDelay)
     {
         const int32_t noDelayFlag = noDelay ? 1 : 0;
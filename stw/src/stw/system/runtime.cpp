@@ -30,6 +30,10 @@
 	#include <sys/wait.h>
 #endif
 
+#if defined(STW_PLATFORM_LINUX)
+	#include <sched.h>
+#endif
+
 #include <filesystem>
 #include <iostream>
 #include <cstring>
@@ -220,4 +224,37 @@ namespace stw::runtime
 		return false;
 #endif
 	}
-}
\ No newline at end of file
+
+	// Restricts the calling thread to the given CPUs. Memory the thread touches first afterwards is placed on
+	// the NUMA node of those CPUs. Returns false when the platform doesn't support it or no CPU was usable
+	bool set_thread_affinity(const std::vector<uint32_t> &cpus)
+	{
+		if (cpus.empty())
+			return false;
+
+#if defined(STW_PLATFORM_WINDOWS)
+		DWORD_PTR mask = 0;
+
+		for (uint32_t cpu : cpus)
+		{
+			if (cpu < sizeof(DWORD_PTR) * 8)
+				mask |= static_cast<DWORD_PTR>(1) << cpu;
+		}
+
+		return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(STW_PLATFORM_LINUX)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		for (uint32_t cpu : cpus)
+		{
+			if (cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+
+		return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+}
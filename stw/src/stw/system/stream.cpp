@@ -20,6 +20,13 @@
 #include <stdexcept>
 #include <cstring>
 
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+	#include <cerrno>
+#endif
+
 namespace stw
 {
 	static std::ios_base::openmode access_to_openmode(file_access access)
@@ -43,6 +50,30 @@ namespace stw
 	file_stream::file_stream(const std::string &filePath, file_access access)
 	{
 		this->access = access;
+		this->fd = -1;
+
+	#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+		if (access == file_access_read)
+		{
+			fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+
+			if (fd < 0)
+				throw std::runtime_error("Failed to open file: " + filePath);
+
+			// Taken from the open file, it stays right if the path is replaced while the stream is read
+			struct stat info;
+
+			if (::fstat(fd, &info) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("Failed to get the size of file: " + filePath);
+			}
+
+			length = static_cast<int64_t>(info.st_size);
+			return;
+		}
+	#endif
+
 		std::ios_base::openmode mode = access_to_openmode(access);
 		file.open(filePath, mode);
 
@@ -60,6 +91,24 @@ namespace stw
 		if (!(access == file_access_read || access == file_access_read_write))
 			throw std::runtime_error("File not opened in read mode");
 
+	#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+		if (fd >= 0)
+		{
+			ssize_t bytesRead;
+
+			do
+			{
+				bytesRead = ::read(fd, buffer, size);
+			} while (bytesRead < 0 && errno == EINTR);
+
+			if (bytesRead < 0)
+				throw std::runtime_error("Failed to read from file");
+
+			readPosition += bytesRead;
+			return bytesRead;
+		}
+	#endif
+
 		file.read(reinterpret_cast<char*>(buffer), size);
 		int64_t bytesRead = file.gcount();
 		readPosition += bytesRead;
@@ -81,6 +130,30 @@ namespace stw
 
 	int64_t file_stream::seek(int64_t offset, seek_origin origin)
 	{
+	#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+		if (fd >= 0)
+		{
+			int whence;
+
+			if (origin == seek_origin_begin)
+				whence = SEEK_SET;
+			else if (origin == seek_origin_current)
+				whence = SEEK_CUR;
+			else if (origin == seek_origin_end)
+				whence = SEEK_END;
+			else
+				throw std::invalid_argument("Invalid seek origin");
+
+			off_t position = ::lseek(fd, static_cast<off_t>(offset), whence);
+
+			if (position < 0)
+				throw std::runtime_error("Seek operation failed");
+
+			readPosition = static_cast<int64_t>(position);
+			return readPosition;
+		}
+	#endif
+
 		if (origin == seek_origin_begin)
 		{
 			file.seekg(offset, std::ios::beg);
@@ -120,10 +193,61 @@ namespace stw
 		return readPosition;
 	}
 
+	int32_t file_stream::get_file_descriptor()
+	{
+		return fd;
+	}
+
 	file_stream::~file_stream()
 	{
 		if (file.is_open())
 			file.close();
+
+	#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+		if (fd >= 0)
+			::close(fd);
+	#endif
+	}
+
+	producer_stream::producer_stream(const producer &callback)
+	{
+		if(!callback)
+			throw std::runtime_error("Producer can not be null");
+
+		this->callback = callback;
+		length = -1;
+	}
+
+	int64_t producer_stream::read(void *buffer, size_t size)
+	{
+		if (!buffer || size == 0)
+			return 0;
+
+		int64_t bytesRead = callback(buffer, size);
+
+		if (bytesRead > 0)
+			readPosition += bytesRead;
+
+		return bytesRead;
+	}
+
+	int64_t producer_stream::write(const void *buffer, size_t size)
+	{
+		(void)buffer;
+		(void)size;
+		throw std::runtime_error("Can not write to a producer stream");
+	}
+
+	int64_t producer_stream::seek(int64_t offset, seek_origin origin)
+	{
+		(void)offset;
+		(void)origin;
+		throw std::runtime_error("Can not seek in a producer stream");
+	}
+
+	int64_t producer_stream::get_read_offset()
+	{
+		return readPosition;
 	}
 
 	memory_stream::memory_stream(void *memory, size_t size, bool copyMemory)
@@ -17,70 +17,272 @@
 // SOFTWARE.
 
 #include "thread_pool.hpp"
+#include "runtime.hpp"
+#include <iostream>
 
 namespace stw
 {
-	thread_pool::thread_pool()
+	// Set on the threads of a pool, so tasks enqueued from inside a task can use the local deque
+	static thread_local thread_pool *gCurrentPool = nullptr;
+	static thread_local size_t gCurrentIndex = 0;
+
+	work_stealing_deque::work_stealing_deque(size_t capacity)
 	{
-		stopFlag.store(false);
+		// Indices are masked, so the capacity is rounded up to a power of two
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+
+		this->capacity = static_cast<int64_t>(size);
+		this->mask = this->capacity - 1;
+		slots = std::make_unique<slot[]>(size);
+		top.store(0);
+		bottom.store(0);
+	}
+
+	bool work_stealing_deque::can_push() const
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		return b - t < capacity && !slots[b & mask].isOccupied.load(std::memory_order_acquire);
+	}
+
+	bool work_stealing_deque::push(unique_function &&task)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+
+		if (b - t >= capacity)
+			return false;
 
-		size_t numThreads = std::thread::hardware_concurrency();
+		slot &target = slots[b & mask];
 
-		for (size_t i = 0; i < numThreads; ++i) 
+		// A thief that claimed the task of the previous round may still be moving it out
+		if (target.isOccupied.load(std::memory_order_acquire))
+			return false;
+
+		target.task = std::move(task);
+		target.isOccupied.store(true, std::memory_order_relaxed);
+
+		// Publishes the task to thieves, they read bottom with acquire
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool work_stealing_deque::pop(unique_function &task)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
 		{
-			workers.push_back(std::thread(&thread_pool::worker_thread, this));
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// The last task may be stolen at the same time, whoever moves top first gets it
+		if (t == b)
+		{
+			bool isTaken = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+
+			if (!isTaken)
+				return false;
 		}
 
-		activeThreads = 0;
+		slot &source = slots[b & mask];
+		task = std::move(source.task);
+		source.isOccupied.store(false, std::memory_order_release);
+		return true;
+	}
+
+	bool work_stealing_deque::steal(unique_function &task)
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+			return false;
+
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+
+		// The slot is ours now, the owner can't fill it again until it is released
+		slot &source = slots[t & mask];
+		task = std::move(source.task);
+		source.isOccupied.store(false, std::memory_order_release);
+		return true;
+	}
+
+	thread_pool::thread_pool(size_t threadCount, size_t queueCapacity, const std::vector<uint32_t> &cpus) : cpus(cpus), injectionQueue(queueCapacity)
+	{
+		stopFlag.store(false);
+		pendingTasks.store(0);
+		sleepingThreads.store(0);
+
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+
+		if (threadCount == 0)
+			threadCount = 1;
+
+		// All deques exist before the first thread starts stealing from them
+		workers.resize(threadCount);
+
+		for (size_t i = 0; i < threadCount; ++i) 
+			workers[i].tasks = std::make_unique<work_stealing_deque>(1024);
+
+		for (size_t i = 0; i < threadCount; ++i) 
+			workers[i].thread = std::thread(&thread_pool::worker_thread, this, i);
 	}
 
 	thread_pool::~thread_pool()
 	{
-		stopFlag.store(true);
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopFlag.store(true);
+		}
+
 		cv.notify_all();
 		
 		for (auto &worker : workers) 
 		{
-			if (worker.joinable())
-				worker.join();
+			if (worker.thread.joinable())
+				worker.thread.join();
 		}
 	}
 
-	void thread_pool::enqueue(std::function<void()> task)
+	bool thread_pool::enqueue(unique_function &&task)
 	{
+		if (!task)
+			return false;
+
+		// A full local deque leaves the task alone, it competes for the shared queue like any other then
+		if (gCurrentPool == this && workers[gCurrentIndex].tasks->can_push())
+		{
+			pendingTasks.fetch_add(1, std::memory_order_seq_cst);
+			workers[gCurrentIndex].tasks->push(std::move(task));
+			wake_one();
+			return true;
+		}
+
+		// Counted before it is visible, so a thread that takes it never sees the count drop below zero
+		pendingTasks.fetch_add(1, std::memory_order_seq_cst);
+
+		if (!injectionQueue.enqueue(std::move(task)))
+		{
+			pendingTasks.fetch_sub(1, std::memory_order_seq_cst);
+			return false;
+		}
+
+		wake_one();
+		return true;
+	}
+
+	void thread_pool::wake_one()
+	{
+		if (sleepingThreads.load(std::memory_order_seq_cst) == 0)
+			return;
+
+		// Taking the lock orders this with a thread that is about to sleep, so the wakeup can't get lost
 		{
 			std::lock_guard<std::mutex> lock(queueMutex);
-			taskQueue.push(task);
 		}
-		cv.notify_one();  // Notify one thread that a task is available
+
+		cv.notify_one();
 	}
 
-	void thread_pool::worker_thread()
+	bool thread_pool::take_task(size_t index, unique_function &task)
 	{
-		while (!stopFlag) 
+		constexpr size_t INJECTION_BATCH_SIZE = 4;
+
+		work_stealing_deque &local = *workers[index].tasks;
+
+		if (local.pop(task))
+			return true;
+
+		if (injectionQueue.try_dequeue(task))
+		{
+			// A few more are moved to the local deque, other threads steal them from there instead of all
+			// competing for the shared queue
+			unique_function next;
+
+			for (size_t i = 1; i < INJECTION_BATCH_SIZE && local.can_push() && injectionQueue.try_dequeue(next); ++i)
+				local.push(std::move(next));
+
+			return true;
+		}
+
+		// Start at the next thread, so thieves don't all go after the same victim
+		for (size_t i = 1; i < workers.size(); ++i)
 		{
-			std::function<void()> task;
+			if (workers[(index + i) % workers.size()].tasks->steal(task))
+				return true;
+		}
+
+		return false;
+	}
+
+	void thread_pool::worker_thread(size_t index)
+	{
+		gCurrentPool = this;
+		gCurrentIndex = index;
+
+		if (!cpus.empty())
+			runtime::set_thread_affinity(cpus);
+
+		while (true) 
+		{
+			unique_function task;
+
+			if (take_task(index, task))
 			{
-				std::unique_lock<std::mutex> lock(queueMutex);
-				cv.wait(lock, [this] { 
-					return !taskQueue.empty() || stopFlag; 
-				});
-				
-				if (stopFlag && taskQueue.empty())
-					return;
-
-				task = taskQueue.front();
-				taskQueue.pop();
+				pendingTasks.fetch_sub(1, std::memory_order_seq_cst);
+
+				// A task that throws must not take the thread with it, the pool would silently shrink
+				try
+				{
+					task();
+				}
+				catch (const std::exception &e)
+				{
+					std::cerr << "Thread pool task threw an exception: " << e.what() << '\n';
+				}
+				catch (...)
+				{
+					std::cerr << "Thread pool task threw an unknown exception\n";
+				}
+
+				continue;
 			}
-			
-			activeThreads++;
-			task();
-			activeThreads--;
+
+			std::unique_lock<std::mutex> lock(queueMutex);
+
+			// Queued tasks are finished before the pool stops
+			if (stopFlag.load() && pendingTasks.load() == 0)
+				return;
+
+			sleepingThreads.fetch_add(1, std::memory_order_seq_cst);
+
+			cv.wait(lock, [this] { 
+				return pendingTasks.load(std::memory_order_seq_cst) > 0 || stopFlag.load(); 
+			});
+
+			sleepingThreads.fetch_sub(1, std::memory_order_seq_cst);
 		}
 	}
 
+	// Only a hint, the queue may fill up before the next enqueue
 	bool thread_pool::is_available() const
 	{
-		return activeThreads < workers.size();
+		return pendingTasks.load(std::memory_order_relaxed) < injectionQueue.get_capacity();
+	}
+
+	size_t thread_pool::get_thread_count() const
+	{
+		return workers.size();
 	}
 }
\ No newline at end of file
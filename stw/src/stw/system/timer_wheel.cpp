@@ -0,0 +1,250 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "timer_wheel.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <bit>
+
+namespace stw
+{
+	timer_node::timer_node()
+	{
+		next = nullptr;
+		prev = nullptr;
+		expiry = 0;
+		userData = nullptr;
+		slot = 0;
+		scheduled = false;
+	}
+
+	bool timer_node::is_scheduled() const
+	{
+		return scheduled;
+	}
+
+	timer_wheel::timer_wheel(uint32_t resolution, size_t slotCount)
+	{
+		if(resolution == 0)
+			throw std::invalid_argument("Resolution must be greater than 0");
+
+		if(slotCount < 64 || (slotCount & (slotCount - 1)) != 0)
+			throw std::invalid_argument("Slot count must be a power of 2 and at least 64");
+
+		this->resolution = resolution;
+		slots.resize(slotCount, nullptr);
+		occupied.resize(slotCount / 64, 0);
+		earliest.resize(slotCount, INT64_MAX);
+		mask = slotCount - 1;
+		currentTick = -1;
+		count = 0;
+	}
+
+	void timer_wheel::schedule(timer_node *node, int64_t expiry)
+	{
+		if(node->scheduled)
+			unlink(node);
+
+		node->expiry = expiry;
+		link(node);
+	}
+
+	void timer_wheel::cancel(timer_node *node)
+	{
+		if(node->scheduled)
+			unlink(node);
+	}
+
+	size_t timer_wheel::advance(int64_t now, std::vector<timer_node*> &expired)
+	{
+		int64_t nowTick = now / resolution;
+		size_t numExpired = 0;
+
+		if(currentTick < 0)
+			currentTick = nowTick;
+
+		if(count == 0)
+		{
+			currentTick = nowTick;
+			return 0;
+		}
+
+		// Slots wrap around, so there is no point in visiting more than all of them once
+		int64_t firstTick = currentTick;
+		int64_t lastTick = nowTick;
+
+		if(lastTick - firstTick >= (int64_t)slots.size())
+			firstTick = lastTick - (int64_t)slots.size() + 1;
+
+		for(int64_t tick = firstTick; tick <= lastTick; tick++)
+		{
+			size_t slot = get_slot(tick);
+			timer_node *node = slots[slot];
+			int64_t slotEarliest = INT64_MAX;
+
+			while(node)
+			{
+				timer_node *next = node->next;
+
+				// Nodes more than one rotation ahead share the slot and stay where they are
+				if(node->expiry <= now)
+				{
+					unlink(node);
+					expired.push_back(node);
+					numExpired++;
+				}
+				else
+				{
+					slotEarliest = std::min(slotEarliest, get_tick(node->expiry));
+				}
+
+				node = next;
+			}
+
+			// Cancelled nodes can leave the recorded tick too low, this is where it catches up
+			earliest[slot] = slotEarliest;
+		}
+
+		currentTick = nowTick;
+		return numExpired;
+	}
+
+	// Milliseconds until the earliest scheduled tick, capped at maxTimeout
+	int32_t timer_wheel::get_timeout(int64_t now, int32_t maxTimeout) const
+	{
+		if(count == 0)
+			return maxTimeout;
+
+		int64_t nextTick = find_next_tick();
+
+		if(nextTick < 0)
+			return maxTimeout;
+
+		int64_t timeout = (nextTick * resolution) - now;
+
+		if(timeout < 0)
+			return 0;
+
+		if(maxTimeout >= 0 && timeout > maxTimeout)
+			return maxTimeout;
+
+		return static_cast<int32_t>(timeout);
+	}
+
+	size_t timer_wheel::get_count() const
+	{
+		return count;
+	}
+
+	size_t timer_wheel::get_slot(int64_t tick) const
+	{
+		return static_cast<size_t>(tick) & mask;
+	}
+
+	// Round up so a timer never fires before its expiry
+	int64_t timer_wheel::get_tick(int64_t expiry) const
+	{
+		return (expiry + resolution - 1) / resolution;
+	}
+
+	void timer_wheel::link(timer_node *node)
+	{
+		int64_t tick = get_tick(node->expiry);
+
+		if(currentTick >= 0 && tick < currentTick)
+			tick = currentTick;
+
+		size_t slot = get_slot(tick);
+
+		node->slot = slot;
+		node->prev = nullptr;
+		node->next = slots[slot];
+
+		if(node->next)
+			node->next->prev = node;
+
+		slots[slot] = node;
+		occupied[slot / 64] |= (uint64_t)1 << (slot % 64);
+		earliest[slot] = std::min(earliest[slot], tick);
+		node->scheduled = true;
+		count++;
+	}
+
+	void timer_wheel::unlink(timer_node *node)
+	{
+		if(node->prev)
+		{
+			node->prev->next = node->next;
+		}
+		else
+		{
+			size_t slot = node->slot;
+			slots[slot] = node->next;
+
+			if(!slots[slot])
+			{
+				occupied[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+				earliest[slot] = INT64_MAX;
+			}
+		}
+
+		if(node->next)
+			node->next->prev = node->prev;
+
+		node->next = nullptr;
+		node->prev = nullptr;
+		node->scheduled = false;
+		count--;
+	}
+
+	int64_t timer_wheel::find_next_tick() const
+	{
+		int64_t startTick = currentTick < 0 ? 0 : currentTick;
+		size_t start = get_slot(startTick);
+		size_t words = occupied.size();
+
+		int64_t nextTick = INT64_MAX;
+
+		// Scan the bitmap from the current slot, wrapping around once. A slot whose earliest tick is past the one
+		// it stands for in this rotation only holds later rotations, so it can only bound the result
+		for(size_t i = 0; i <= words; i++)
+		{
+			size_t wordIndex = ((start / 64) + i) % words;
+			uint64_t word = occupied[wordIndex];
+
+			if(i == 0)
+				word &= ~(uint64_t)0 << (start % 64);
+			else if(i == words)
+				word &= ((uint64_t)1 << (start % 64)) - 1;
+
+			while(word != 0)
+			{
+				size_t slot = wordIndex * 64 + std::countr_zero(word);
+				size_t distance = (slot - start) & mask;
+				int64_t tick = startTick + (int64_t)distance;
+
+				if(earliest[slot] <= tick)
+					return tick;
+
+				nextTick = std::min(nextTick, earliest[slot]);
+				word &= word - 1;
+			}
+		}
+
+		return nextTick == INT64_MAX ? -1 : nextTick;
+	}
+}
@@ -0,0 +1,92 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "test.hpp"
+#include "http_stream.hpp"
+#include "socket.hpp"
+#include <string>
+
+using namespace stw;
+
+// Decodes a body that is completely in the initial content, the socket is never read
+static int64_t decode(const std::string &body, std::string &out, http_stream &stream, uint64_t maxBodySize = 0)
+{
+	static stw::socket unused;
+	char buffer[256];
+	int64_t result = 0;
+
+	stream.reset(&unused, body.data(), body.size());
+	stream.set_chunked(maxBodySize);
+	out.clear();
+
+	while ((result = stream.read(buffer, sizeof(buffer))) > 0)
+		out.append(buffer, static_cast<size_t>(result));
+
+	return result;
+}
+
+static void test_valid_chunks()
+{
+	http_stream stream;
+	std::string out;
+
+	STW_CHECK(decode("5\r\nhello\r\n1;name=value\r\n!\r\n0\r\nX-Trailer: 1\r\n\r\nGET", out, stream) == 0);
+	STW_CHECK(out == "hello!");
+	STW_CHECK(stream.is_complete());
+	STW_CHECK(!stream.is_invalid());
+	STW_CHECK(stream.get_surplus_bytes() == 3);
+}
+
+// A size line without digits must not pass for the last chunk
+static void test_size_without_digits()
+{
+	const char *bodies[] = { "\r\n\r\n", ";ext\r\n\r\n", " \r\n\r\n", "5\r\nhello\r\n\r\n\r\n", "5\r\nhello\r\n;x\r\n0\r\n\r\n" };
+
+	for (const char *body : bodies)
+	{
+		http_stream stream;
+		std::string out;
+
+		STW_CHECK(decode(body, out, stream) < 0);
+		STW_CHECK(stream.is_invalid());
+		STW_CHECK(!stream.is_too_large());
+		STW_CHECK(!stream.is_complete());
+	}
+}
+
+static void test_body_limit()
+{
+	http_stream stream;
+	std::string out;
+
+	STW_CHECK(decode("4\r\nabcd\r\n3\r\nefg\r\n0\r\n\r\n", out, stream, 6) < 0);
+	STW_CHECK(stream.is_invalid());
+	STW_CHECK(stream.is_too_large());
+
+	STW_CHECK(decode("4\r\nabcd\r\n2\r\nef\r\n0\r\n\r\n", out, stream, 6) == 0);
+	STW_CHECK(out == "abcdef");
+	STW_CHECK(!stream.is_too_large());
+}
+
+int main()
+{
+	test_valid_chunks();
+	test_size_without_digits();
+	test_body_limit();
+	return 0;
+}
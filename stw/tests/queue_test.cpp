@@ -0,0 +1,120 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "test.hpp"
+#include "queue.hpp"
+#include <memory>
+#include <thread>
+
+using namespace stw;
+
+static void test_dequeue_bulk_partial_and_empty()
+{
+	queue<int, 8> q;
+	int values[8];
+
+	STW_CHECK(q.try_dequeue_bulk(values, 8) == 0);
+
+	for (int i = 0; i < 5; i++)
+		STW_CHECK(q.enqueue(i));
+
+	STW_CHECK(q.try_dequeue_bulk(values, 3) == 3);
+	STW_CHECK(values[0] == 0 && values[1] == 1 && values[2] == 2);
+	STW_CHECK(q.try_dequeue_bulk(values, 8) == 2);
+	STW_CHECK(values[0] == 3 && values[1] == 4);
+	STW_CHECK(q.try_dequeue_bulk(values, 8) == 0);
+}
+
+// The indices wrap after Size slots, a bulk dequeue that crosses the end must keep the order
+static void test_dequeue_bulk_wraps()
+{
+	queue<std::unique_ptr<int>, 8> q;
+	std::unique_ptr<int> values[8];
+	int next = 0;
+	int expected = 0;
+
+	for (int round = 0; round < 10; round++)
+	{
+		while (q.enqueue(std::make_unique<int>(next)))
+			next++;
+
+		size_t count = q.try_dequeue_bulk(values, 5);
+		STW_CHECK(count == 5);
+
+		for (size_t i = 0; i < count; i++)
+			STW_CHECK(values[i] && *values[i] == expected++);
+	}
+}
+
+static void test_dequeue_bulk_across_threads()
+{
+	constexpr int COUNT = 1000000;
+	queue<int, 1024> q;
+
+	std::thread producer([&q]() {
+		for (int i = 0; i < COUNT; i++)
+		{
+			while (!q.enqueue(i))
+				std::this_thread::yield();
+		}
+	});
+
+	int values[64];
+	int expected = 0;
+
+	while (expected < COUNT)
+	{
+		size_t count = q.try_dequeue_bulk(values, 64);
+
+		if (count == 0)
+			std::this_thread::yield();
+
+		for (size_t i = 0; i < count; i++)
+			STW_CHECK(values[i] == expected++);
+	}
+
+	producer.join();
+	STW_CHECK(q.try_dequeue_bulk(values, 64) == 0);
+}
+
+static void test_mpmc_capacity()
+{
+	mpmc_queue<int> q(5);
+	int value = 0;
+
+	STW_CHECK(q.get_capacity() == 8);
+
+	for (int i = 0; i < 8; i++)
+		STW_CHECK(q.enqueue(int(i)));
+
+	STW_CHECK(!q.enqueue(8));
+
+	for (int i = 0; i < 8; i++)
+		STW_CHECK(q.try_dequeue(value) && value == i);
+
+	STW_CHECK(!q.try_dequeue(value));
+}
+
+int main()
+{
+	test_dequeue_bulk_partial_and_empty();
+	test_dequeue_bulk_wraps();
+	test_dequeue_bulk_across_threads();
+	test_mpmc_capacity();
+	return 0;
+}
@@ -0,0 +1,111 @@
+// MIT License
+// Copyright © 2025 W.M.R Jap-A-Joe
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "test.hpp"
+#include "timer_wheel.hpp"
+
+using namespace stw;
+
+static void test_expires_in_order()
+{
+	timer_wheel wheel(100, 1024);
+	std::vector<timer_node*> expired;
+	timer_node a, b;
+
+	wheel.advance(1000, expired);
+	wheel.schedule(&a, 1250);
+	wheel.schedule(&b, 1500);
+
+	STW_CHECK(wheel.get_timeout(1000, -1) == 300);
+	STW_CHECK(wheel.advance(1250, expired) == 0);
+	STW_CHECK(wheel.advance(1300, expired) == 1);
+	STW_CHECK(expired[0] == &a);
+	STW_CHECK(wheel.get_timeout(1300, -1) == 200);
+
+	wheel.cancel(&b);
+	STW_CHECK(wheel.get_count() == 0);
+	STW_CHECK(wheel.get_timeout(1300, 5000) == 5000);
+}
+
+// A timer more than one rotation (1024 * 100 ms) ahead shares its slot with nearer ticks
+static void test_timer_beyond_one_rotation()
+{
+	timer_wheel wheel(100, 1024);
+	std::vector<timer_node*> expired;
+	timer_node node;
+	int64_t now = 1000000;
+
+	wheel.advance(now, expired);
+	wheel.schedule(&node, now + 200000);
+
+	STW_CHECK(wheel.get_timeout(now, -1) == 200000);
+
+	// Step through the first rotation, the current slot is the one the timer hashes to at some point
+	for(int64_t t = now + 100; t < now + 200000; t += 100)
+	{
+		STW_CHECK(wheel.advance(t, expired) == 0);
+		STW_CHECK(wheel.get_timeout(t, -1) == now + 200000 - t);
+	}
+
+	STW_CHECK(wheel.advance(now + 200000, expired) == 1);
+	STW_CHECK(expired.size() == 1 && expired[0] == &node);
+	STW_CHECK(wheel.get_count() == 0);
+}
+
+// Exactly one rotation ahead lands in the current slot
+static void test_timer_in_current_slot_next_rotation()
+{
+	timer_wheel wheel(100, 1024);
+	std::vector<timer_node*> expired;
+	timer_node node;
+	int64_t now = 500000;
+
+	wheel.advance(now, expired);
+	wheel.schedule(&node, now + 102400);
+
+	STW_CHECK(wheel.get_timeout(now, -1) == 102400);
+	STW_CHECK(wheel.get_timeout(now + 50, 1000) == 1000);
+	STW_CHECK(wheel.advance(now + 50, expired) == 0);
+	STW_CHECK(wheel.get_timeout(now + 50, -1) == 102350);
+}
+
+static void test_cancel_keeps_later_rotation()
+{
+	timer_wheel wheel(100, 1024);
+	std::vector<timer_node*> expired;
+	timer_node near, far;
+	int64_t now = 0;
+
+	wheel.advance(now, expired);
+	wheel.schedule(&near, 300);
+	wheel.schedule(&far, 300 + 102400);
+	wheel.cancel(&near);
+
+	// The slot may still report the cancelled tick once, after that the wheel knows better
+	STW_CHECK(wheel.advance(300, expired) == 0);
+	STW_CHECK(wheel.get_timeout(300, -1) == 102400);
+}
+
+int main()
+{
+	test_expires_in_order();
+	test_timer_beyond_one_rotation();
+	test_timer_in_current_slot_next_rotation();
+	test_cancel_keeps_later_rotation();
+	return 0;
+}